@@ -0,0 +1,501 @@
+/*
+ *******************************************************************************
+ *                                                                             *
+ *                            Filename: bench.c                                *
+ *                                                                             *
+ *                      Author: Amoiridis Vasileios 8772                       *
+ *                                                                             *
+ *                             Date: 17 Oct 2026                               *
+ *******************************************************************************
+ */
+#define _GNU_SOURCE         /* mkdtemp(), wait4()                             */
+#include <stdio.h>          /* Standard Library                               */
+#include <stdlib.h>         /* Standard Library                               */
+#include <string.h>         /* strcmp(), memset()                             */
+#include <sys/types.h>      /* pid_t                                          */
+#include <sys/stat.h>       /* stat() of the generated files                  */
+#include <sys/wait.h>       /* waitpid(), wait4()                             */
+#include <sys/resource.h>   /* struct rusage, peak RSS of the shell           */
+#include <unistd.h>         /* getopt(), unlink(), rmdir()                    */
+#include <fcntl.h>          /* O_WRONLY for /dev/null                         */
+#include <spawn.h>          /* posix_spawn() of the shell and the baseline    */
+#include <time.h>           /* clock_gettime()                                */
+
+extern char **environ;      /* environment passed to posix_spawn()            */
+
+/*
+ *******************************************************************************
+ * DEFINES                                                                     *
+ *******************************************************************************
+ */
+#define SHELL_DEFAULT "bin/myshell"
+#define OUTPUT_DEFAULT "bench_results.json"
+#define REPEAT_DEFAULT 3    /* runs of each case, the fastest one counts      */
+#define TRUE_PATH "/bin/true"
+#define CAT_PATH "/bin/cat" /* by path, so the builtin cat is skipped        */
+#define PATH_LEN 512
+#define MB (1024.0 * 1024.0)
+
+/*
+ *******************************************************************************
+ * Types                                                                       *
+ *******************************************************************************
+ */
+typedef struct
+{
+	const char *name;
+	void      (*generate)(FILE *batch, int scale);
+	long        commands;       /* commands run by one pass of the batch     */
+	long        bytes;          /* bytes through the pipelines, or 0         */
+} Case;
+
+typedef struct
+{
+	const Case *bench;
+	double      wall_s;         /* fastest run                               */
+	long        rss_kb;         /* peak RSS of the shell and its children    */
+	double      cmds_per_s;
+	double      overhead_us;    /* wall time per command, for tiny_external  */
+	                            /* less the time of a bare spawn             */
+	double      mb_per_s;
+	long        batch_bytes;    /* size of the batchfile                     */
+	int         failed;         /* the shell exited with an error            */
+} Result;
+
+/*
+ *******************************************************************************
+ * Functions' definitions                                                      *
+ *******************************************************************************
+ */
+void   genTiny          (FILE *batch, int scale);
+void   genBuiltin       (FILE *batch, int scale);
+void   genChainSeq      (FILE *batch, int scale);
+void   genChainAnd      (FILE *batch, int scale);
+void   genPipeline      (FILE *batch, int scale);
+void   genRedirect      (FILE *batch, int scale);
+void   genLongLine      (FILE *batch, int scale);
+void   makeData         (const char *path, long bytes);
+int    runShell         (const char *shell, const char *batchfile,
+                         double *wall_s, long *rss_kb);
+double spawnBaseline    (long count);
+double now              (void);
+void   writeResults     (const char *file, Result *results, int nresults,
+                         const char *shell, int scale);
+
+/*
+ *******************************************************************************
+ * Benchmark cases. The number of commands and of piped bytes is for scale 1;  *
+ * both grow linearly with -x.                                                 *
+ *******************************************************************************
+ */
+#define TINY_LINES 2000
+#define BUILTIN_LINES 50000
+#define CHAIN_LINES 500
+#define CHAIN_LEN 100
+#define PIPE_LINES 8
+#define PIPE_STAGES 8
+#define PIPE_BYTES (16L * 1024 * 1024)
+#define REDIRECT_LINES 1000
+#define LONG_LINES 20
+#define LONG_ARGS 50000
+
+static Case cases[] =
+{
+	{"tiny_external", genTiny,     TINY_LINES,                 0},
+	{"tiny_builtin",  genBuiltin,  BUILTIN_LINES,              0},
+	{"chain_seq",     genChainSeq, CHAIN_LINES * CHAIN_LEN,    0},
+	{"chain_and",     genChainAnd, CHAIN_LINES * CHAIN_LEN,    0},
+	{"deep_pipeline", genPipeline, PIPE_LINES * PIPE_STAGES,
+	                               PIPE_LINES * PIPE_STAGES * PIPE_BYTES},
+	{"redirect",      genRedirect, REDIRECT_LINES,             0},
+	{"long_line",     genLongLine, LONG_LINES,                 0},
+	{NULL,            NULL,        0,                          0}
+};
+
+static char dir[] = "/tmp/myshell-bench-XXXXXX"; /* the data and out files   */
+
+/*
+ *******************************************************************************
+ * Main Code                                                                   *
+ *******************************************************************************
+ */
+int main(int argc, char *argv[])
+{
+	const char *shell = SHELL_DEFAULT, *output = OUTPUT_DEFAULT;
+	char batchfile[PATH_LEN];
+	Result results[sizeof(cases) / sizeof(cases[0])];
+	int repeat = REPEAT_DEFAULT, scale = 1, opt, i, r, nresults = 0;
+	double wall_s, baseline_us;
+	struct stat st;
+	long rss_kb;
+	FILE *batch;
+
+	while((opt = getopt(argc, argv, "s:o:r:x:")) != -1)
+	{
+		switch (opt)
+		{
+			case 's':
+				shell = optarg;
+				break;
+			case 'o':
+				output = optarg;
+				break;
+			case 'r':
+				repeat = atoi(optarg);
+				break;
+			case 'x':
+				scale = atoi(optarg);
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-s shell] [-o results.json] "
+				        "[-r repeat] [-x scale]\n", argv[0]);
+				exit(EXIT_FAILURE);
+		}
+	}
+	repeat = (repeat > 0) ? repeat : 1;
+	scale = (scale > 0) ? scale : 1;
+
+	if(access(shell, X_OK) < 0)
+	{
+		perror(shell);
+		exit(EXIT_FAILURE);
+	}
+	if(mkdtemp(dir) == NULL)
+	{
+		perror("mkdtemp");
+		exit(EXIT_FAILURE);
+	}
+
+	//What the kernel alone needs to start and reap one process.
+	for(r = 0, baseline_us = -1; r < repeat; r++)
+	{
+		wall_s = spawnBaseline(TINY_LINES * scale) * 1e6 / (TINY_LINES * scale);
+		baseline_us = (baseline_us < 0 || wall_s < baseline_us) ? wall_s
+		                                                       : baseline_us;
+	}
+
+	printf("%-14s %10s %12s %12s %10s %10s\n", "case", "wall s", "cmds/s",
+	       "overhead us", "MB/s", "peak kB");
+	for(i = 0; cases[i].name != NULL; i++)
+	{
+		Result *res = &results[nresults++];
+
+		snprintf(batchfile, sizeof(batchfile), "%s/%s.batch", dir,
+		         cases[i].name);
+		batch = fopen(batchfile, "w");
+		if(batch == NULL)
+		{
+			perror(batchfile);
+			exit(EXIT_FAILURE);
+		}
+		cases[i].generate(batch, scale);
+		fclose(batch);
+
+		memset(res, 0, sizeof(*res));
+		res->bench = &cases[i];
+		res->wall_s = -1;
+		stat(batchfile, &st);
+		res->batch_bytes = st.st_size;
+		for(r = 0; r < repeat; r++)
+		{
+			res->failed |= runShell(shell, batchfile, &wall_s, &rss_kb);
+			if(res->wall_s < 0 || wall_s < res->wall_s)
+			{
+				res->wall_s = wall_s;
+			}
+			res->rss_kb = (rss_kb > res->rss_kb) ? rss_kb : res->rss_kb;
+		}
+
+		res->cmds_per_s = cases[i].commands * scale / res->wall_s;
+		res->overhead_us = res->wall_s * 1e6 / (cases[i].commands * scale);
+		if(cases[i].generate == genTiny)
+		{
+			res->overhead_us -= baseline_us; //only what the shell adds.
+		}
+		if(cases[i].bytes != 0)
+		{
+			res->mb_per_s = cases[i].bytes * scale / MB / res->wall_s;
+		}
+		else if(cases[i].generate == genLongLine)
+		{
+			res->mb_per_s = res->batch_bytes / MB / res->wall_s; //parsing.
+		}
+
+		printf("%-14s %10.3f %12.0f %12.2f %10.1f %10ld%s\n", cases[i].name,
+		       res->wall_s, res->cmds_per_s, res->overhead_us, res->mb_per_s,
+		       res->rss_kb, res->failed ? "  (shell failed)" : "");
+		fflush(stdout);
+		unlink(batchfile);
+	}
+	printf("bare posix_spawn + wait: %.2f us per command\n", baseline_us);
+
+	writeResults(output, results, nresults, shell, scale);
+	printf("results written to %s\n", output);
+
+	snprintf(batchfile, sizeof(batchfile), "%s/data", dir);
+	unlink(batchfile);
+	snprintf(batchfile, sizeof(batchfile), "%s/out", dir);
+	unlink(batchfile);
+	rmdir(dir);
+
+	return 0;
+}
+
+/*
+ *******************************************************************************
+ * genTiny() writes many tiny external commands. Given by path they skip the   *
+ * builtins and the $PATH search, so the time is the launch and the reaping.   *
+ *******************************************************************************
+ */
+void genTiny(FILE *batch, int scale)
+{
+	long i;
+
+	for(i = 0; i < (long)TINY_LINES * scale; i++)
+	{
+		fprintf(batch, TRUE_PATH "\n");
+	}
+}
+
+/*
+ *******************************************************************************
+ * genBuiltin() writes many builtin commands: only the shell's own per line    *
+ * work is measured, with no process at all.                                   *
+ *******************************************************************************
+ */
+void genBuiltin(FILE *batch, int scale)
+{
+	long i;
+
+	for(i = 0; i < (long)BUILTIN_LINES * scale; i++)
+	{
+		fprintf(batch, "true\n");
+	}
+}
+
+/*
+ *******************************************************************************
+ * genChainSeq() and genChainAnd() write long ';' and '&&' chains of builtins. *
+ *******************************************************************************
+ */
+void genChainSeq(FILE *batch, int scale)
+{
+	long i, j;
+
+	for(i = 0; i < (long)CHAIN_LINES * scale; i++)
+	{
+		for(j = 0; j < CHAIN_LEN - 1; j++)
+		{
+			fprintf(batch, "true ; ");
+		}
+		fprintf(batch, "true\n");
+	}
+}
+
+void genChainAnd(FILE *batch, int scale)
+{
+	long i, j;
+
+	for(i = 0; i < (long)CHAIN_LINES * scale; i++)
+	{
+		for(j = 0; j < CHAIN_LEN - 1; j++)
+		{
+			fprintf(batch, "true && ");
+		}
+		fprintf(batch, "true\n");
+	}
+}
+
+/*
+ *******************************************************************************
+ * genPipeline() writes deep pipelines of /bin/cat that move PIPE_BYTES each,  *
+ * so the throughput of the pipes that the shell sets up is measured.          *
+ *******************************************************************************
+ */
+void genPipeline(FILE *batch, int scale)
+{
+	char data[PATH_LEN];
+	long i, j;
+
+	snprintf(data, sizeof(data), "%s/data", dir);
+	makeData(data, PIPE_BYTES);
+	for(i = 0; i < (long)PIPE_LINES * scale; i++)
+	{
+		fprintf(batch, CAT_PATH " < %s", data);
+		for(j = 1; j < PIPE_STAGES; j++)
+		{
+			fprintf(batch, " | " CAT_PATH);
+		}
+		fprintf(batch, " > /dev/null\n");
+	}
+}
+
+/*
+ *******************************************************************************
+ * genRedirect() writes lines that open a '<' and a '>' file each.             *
+ *******************************************************************************
+ */
+void genRedirect(FILE *batch, int scale)
+{
+	char data[PATH_LEN];
+	long i;
+
+	snprintf(data, sizeof(data), "%s/data", dir);
+	makeData(data, 4096);
+	for(i = 0; i < (long)REDIRECT_LINES * scale; i++)
+	{
+		fprintf(batch, CAT_PATH " < %s > %s/out\n", data, dir);
+	}
+}
+
+/*
+ *******************************************************************************
+ * genLongLine() writes very long lines, with LONG_ARGS arguments each, for    *
+ * the tokenizer and the parser.                                               *
+ *******************************************************************************
+ */
+void genLongLine(FILE *batch, int scale)
+{
+	long i, j;
+
+	for(i = 0; i < (long)LONG_LINES * scale; i++)
+	{
+		fprintf(batch, "true");
+		for(j = 0; j < LONG_ARGS; j++)
+		{
+			fprintf(batch, " arg%ld", j);
+		}
+		fprintf(batch, "\n");
+	}
+}
+
+/*
+ *******************************************************************************
+ * makeData() writes a file of bytes bytes of text lines.                      *
+ *******************************************************************************
+ */
+void makeData(const char *path, long bytes)
+{
+	static const char line[] = "the quick brown fox jumps over the lazy dog\n";
+	FILE *data = fopen(path, "w");
+	long written;
+
+	if(data == NULL)
+	{
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	for(written = 0; written + (long)sizeof(line) - 1 <= bytes;
+	    written += sizeof(line) - 1)
+	{
+		fputs(line, data);
+	}
+	fclose(data);
+}
+
+/*
+ *******************************************************************************
+ * runShell() runs the shell on a batchfile with its stdout on /dev/null. It   *
+ * returns the wall time and the peak RSS (the largest of the shell and its    *
+ * children, from wait4()), and 1 if the shell did not exit with 0.            *
+ *******************************************************************************
+ */
+int runShell(const char *shell, const char *batchfile, double *wall_s,
+             long *rss_kb)
+{
+	posix_spawn_file_actions_t actions;
+	char *argv[] = {(char*)shell, (char*)batchfile, NULL};
+	struct rusage ru;
+	double start;
+	int status;
+	pid_t pid;
+
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null",
+	                                 O_WRONLY, 0);
+	start = now();
+	if(posix_spawn(&pid, shell, &actions, NULL, argv, environ) != 0)
+	{
+		perror(shell);
+		exit(EXIT_FAILURE);
+	}
+	posix_spawn_file_actions_destroy(&actions);
+	while(wait4(pid, &status, 0, &ru) < 0);
+	*wall_s = now() - start;
+	*rss_kb = ru.ru_maxrss;
+
+	return !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+}
+
+/*
+ *******************************************************************************
+ * spawnBaseline() starts and reaps count processes of /bin/true one after the *
+ * other, with nothing else, and returns the time it took.                     *
+ *******************************************************************************
+ */
+double spawnBaseline(long count)
+{
+	char *argv[] = {TRUE_PATH, NULL};
+	double start = now();
+	pid_t pid;
+	long i;
+
+	for(i = 0; i < count; i++)
+	{
+		if(posix_spawn(&pid, TRUE_PATH, NULL, NULL, argv, environ) == 0)
+		{
+			waitpid(pid, NULL, 0);
+		}
+	}
+
+	return now() - start;
+}
+
+/*
+ *******************************************************************************
+ * now() returns the monotonic clock in seconds.                               *
+ *******************************************************************************
+ */
+double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ *******************************************************************************
+ * writeResults() writes the results as one JSON object, so that runs can be   *
+ * compared by scripts.                                                        *
+ *******************************************************************************
+ */
+void writeResults(const char *file, Result *results, int nresults,
+                  const char *shell, int scale)
+{
+	FILE *out = fopen(file, "w");
+	int i;
+
+	if(out == NULL)
+	{
+		perror(file);
+		exit(EXIT_FAILURE);
+	}
+
+	fprintf(out, "{\n  \"shell\": \"%s\",\n  \"scale\": %d,\n  \"cases\": [\n",
+	        shell, scale);
+	for(i = 0; i < nresults; i++)
+	{
+		fprintf(out, "    {\"name\": \"%s\", \"commands\": %ld, "
+		        "\"batch_bytes\": %ld, \"wall_s\": %.6f, \"cmds_per_s\": %.1f, "
+		        "\"overhead_us\": %.3f, \"mb_per_s\": %.2f, \"peak_rss_kb\": %ld, "
+		        "\"failed\": %s}%s\n", results[i].bench->name,
+		        results[i].bench->commands * scale, results[i].batch_bytes,
+		        results[i].wall_s, results[i].cmds_per_s,
+		        results[i].overhead_us, results[i].mb_per_s,
+		        results[i].rss_kb, results[i].failed ? "true" : "false",
+		        (i < nresults - 1) ? "," : "");
+	}
+	fprintf(out, "  ]\n}\n");
+	fclose(out);
+}
@@ -0,0 +1,306 @@
+/*
+ *******************************************************************************
+ *                                                                             *
+ *                           Filename: myclient.c                              *
+ *                                                                             *
+ *                      Author: Amoiridis Vasileios 8772                       *
+ *                                                                             *
+ *                             Date: 17 Oct 2026                               *
+ *******************************************************************************
+ */
+#define _GNU_SOURCE         /* clock_gettime()                                */
+#include <stdio.h>          /* Standard Library                               */
+#include <stdlib.h>         /* Standard Library                               */
+#include <string.h>         /* strlen(), memcpy()                             */
+#include <stdint.h>         /* uint32_t lengths of the frames                 */
+#include <unistd.h>         /* getopt(), read(), write()                      */
+#include <errno.h>          /* EINTR                                          */
+#include <sys/socket.h>     /* socket(), connect()                            */
+#include <sys/un.h>         /* struct sockaddr_un                             */
+#include <arpa/inet.h>      /* htonl(), ntohl()                               */
+#include <time.h>           /* clock_gettime()                                */
+
+/*
+ *******************************************************************************
+ * DEFINES                                                                     *
+ *******************************************************************************
+ */
+#define FRAME_HEAD 5        /* type byte and payload length of a frame        */
+#define FRAME_MAX 65536     /* largest payload, as in myshell.c               */
+#define FRAME_SCRIPT 'S'    /* client: part of the script                     */
+#define FRAME_RUN 'R'       /* client: last part of the script, run it        */
+#define FRAME_OUT 'O'       /* server: stdout of the script                   */
+#define FRAME_ERR 'E'       /* server: stderr of the script                   */
+#define FRAME_EXIT 'X'      /* server: exit status, the request is over       */
+#define READ_CHUNK 65536    /* bytes read at a time from the script file      */
+#define USAGE "Usage: %s [-c line] [-r repeat] socket [script]\n"
+
+/*
+ *******************************************************************************
+ * Functions' definitions                                                      *
+ *******************************************************************************
+ */
+char*  readScript       (FILE *input, size_t *len);
+int    sendScript       (int fd, const char *script, size_t len);
+int    recvResult       (int fd);
+int    readAll          (int fd, char *buf, size_t len);
+int    writeAll         (int fd, const char *buf, size_t len);
+double now              (void);
+
+/*
+ *******************************************************************************
+ * Main Code                                                                   *
+ * myclient sends a script to a shell started with 'myshell -L socket' and     *
+ * prints what it writes, then exits with its exit status. The script is the   *
+ * -c line, the file or stdin. -r N sends it N times on the same connection    *
+ * and prints the round trip of a request to stderr.                           *
+ *******************************************************************************
+ */
+int main(int argc, char *argv[])
+{
+	struct sockaddr_un addr;
+	const char *line = NULL;
+	char *script;
+	size_t len;
+	int repeat = 1, opt, fd, status = EXIT_FAILURE, r;
+	double start, total = 0, best = -1, took;
+	FILE *input = stdin;
+
+	while((opt = getopt(argc, argv, "c:r:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'c':
+				line = optarg;
+				break;
+			case 'r':
+				repeat = atoi(optarg);
+				break;
+			default:
+				fprintf(stderr, USAGE, argv[0]);
+				exit(EXIT_FAILURE);
+		}
+	}
+	if(optind >= argc || argc - optind > 2 ||
+	   (line != NULL && argc - optind > 1))
+	{
+		fprintf(stderr, USAGE, argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	repeat = (repeat > 0) ? repeat : 1;
+
+	if(line != NULL)
+	{
+		len = strlen(line);
+		script = malloc(len + 1);
+		if(script == NULL)
+		{
+			fprintf(stderr,"ERROR: malloc() failure.\n");
+			exit(EXIT_FAILURE);
+		}
+		memcpy(script, line, len);
+		script[len++] = '\n';
+	}
+	else
+	{
+		if(argc - optind == 2 && (input = fopen(argv[optind + 1], "r")) == NULL)
+		{
+			perror(argv[optind + 1]);
+			exit(EXIT_FAILURE);
+		}
+		script = readScript(input, &len);
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, argv[optind], sizeof(addr.sun_path) - 1);
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+	{
+		perror(argv[optind]);
+		exit(EXIT_FAILURE);
+	}
+
+	for(r = 0; r < repeat; r++)
+	{
+		start = now();
+		if(sendScript(fd, script, len) || (status = recvResult(fd)) < 0)
+		{
+			fprintf(stderr, "ERROR: the server closed the connection.\n");
+			exit(EXIT_FAILURE);
+		}
+		took = now() - start;
+		total += took;
+		best = (best < 0 || took < best) ? took : best;
+	}
+	if(repeat > 1)
+	{
+		fprintf(stderr, "%d requests: %.1f us mean, %.1f us best\n", repeat,
+		        total * 1e6 / repeat, best * 1e6);
+	}
+
+	close(fd);
+	free(script);
+	return status;
+}
+
+/*
+ *******************************************************************************
+ * readScript() reads the whole input into a malloc'd buffer and stores its    *
+ * length in len.                                                              *
+ *******************************************************************************
+ */
+char* readScript(FILE *input, size_t *len)
+{
+	char *script = NULL;
+	size_t size = 0, n;
+
+	*len = 0;
+	do
+	{
+		if(*len + READ_CHUNK > size)
+		{
+			size = 2 * size + READ_CHUNK;
+			script = realloc(script, size);
+			if(script == NULL)
+			{
+				fprintf(stderr,"ERROR: malloc() failure.\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+		n = fread(script + *len, 1, READ_CHUNK, input);
+		*len += n;
+	} while(n > 0);
+
+	return script;
+}
+
+/*
+ *******************************************************************************
+ * sendScript() sends the script in FRAME_SCRIPT frames of FRAME_MAX bytes,    *
+ * the last part in a FRAME_RUN frame. It returns 0, or 1 on an error.         *
+ *******************************************************************************
+ */
+int sendScript(int fd, const char *script, size_t len)
+{
+	char frame[FRAME_HEAD + FRAME_MAX];
+	uint32_t n;
+
+	do
+	{
+		n = (len > FRAME_MAX) ? FRAME_MAX : len;
+		frame[0] = (len > FRAME_MAX) ? FRAME_SCRIPT : FRAME_RUN;
+		memcpy(frame + FRAME_HEAD, script, n);
+		script += n;
+		len -= n;
+		n = htonl(n);
+		memcpy(frame + 1, &n, sizeof(n));
+		if(writeAll(fd, frame, FRAME_HEAD + ntohl(n)))
+		{
+			return 1;
+		}
+	} while(len > 0);
+
+	return 0;
+}
+
+/*
+ *******************************************************************************
+ * recvResult() writes the FRAME_OUT and FRAME_ERR frames of a request to      *
+ * stdout and stderr until its FRAME_EXIT, and returns the exit status in it,  *
+ * or -1 when the connection ends first.                                       *
+ *******************************************************************************
+ */
+int recvResult(int fd)
+{
+	char head[FRAME_HEAD], payload[FRAME_MAX];
+	uint32_t n;
+
+	while(readAll(fd, head, FRAME_HEAD) == 0)
+	{
+		memcpy(&n, head + 1, sizeof(n));
+		n = ntohl(n);
+		if(n > FRAME_MAX || readAll(fd, payload, n))
+		{
+			break;
+		}
+		if(head[0] == FRAME_EXIT && n == sizeof(n))
+		{
+			memcpy(&n, payload, sizeof(n));
+			return (int)ntohl(n);
+		}
+		writeAll((head[0] == FRAME_ERR) ? STDERR_FILENO : STDOUT_FILENO,
+		         payload, n);
+	}
+
+	return -1;
+}
+
+/*
+ *******************************************************************************
+ * readAll() reads exactly len bytes. It returns 0, or 1 on an error or when   *
+ * the data ends first.                                                        *
+ *******************************************************************************
+ */
+int readAll(int fd, char *buf, size_t len)
+{
+	ssize_t n;
+
+	while(len > 0)
+	{
+		n = read(fd, buf, len);
+		if(n < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if(n <= 0)
+		{
+			return 1;
+		}
+		buf += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/*
+ *******************************************************************************
+ * writeAll() writes len bytes of buf to fd, going on after short writes. It   *
+ * returns 0, or -1 on error.                                                  *
+ *******************************************************************************
+ */
+int writeAll(int fd, const char *buf, size_t len)
+{
+	ssize_t n;
+
+	while(len > 0)
+	{
+		n = write(fd, buf, len);
+		if(n < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if(n < 0)
+		{
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/*
+ *******************************************************************************
+ * now() returns the monotonic clock in seconds.                               *
+ *******************************************************************************
+ */
+double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -8,30 +8,437 @@
  *                             Date: 12 Jan 2020                               *
  *******************************************************************************
  */
+#define _GNU_SOURCE         /* pipe2(), getopt_long()                         */
 #include <stdio.h>          /* Standard Library                               */
 #include <stdlib.h>         /* Standard Library                               */
-#include <string.h>         /* strlen(), strtok()                             */
+#include <string.h>         /* strlen(), memchr(), memcpy()                   */
+#include <ctype.h>          /* toupper() for the size suffixes of 'limit'     */
 #include <sys/types.h>      /* fork(),getpid() system calls                   */
 #include <sys/stat.h>       /* contains info about open(), creat()            */
 #include <sys/wait.h>       /* wait() system calls                            */
 #include <unistd.h>         /* fork(),getpid() system calls                   */  
 #include <errno.h>          /* contains the errors' descriptions              */
 #include <fcntl.h>          /* contains information about file descriptor     */
+#include <spawn.h>          /* posix_spawnp() and its file actions            */
+#include <getopt.h>         /* getopt_long()                                  */
+#include <signal.h>         /* SIGPIPE handling for in-process builtins       */
+#include <limits.h>         /* PATH_MAX                                       */
+#include <sched.h>          /* CPU affinity and scheduling policy of a stage  */
+#include <sys/epoll.h>      /* the child supervisor's event loop              */
+#include <poll.h>           /* poll() in the --pipe-stats relays              */
+#include <sys/syscall.h>    /* pidfd_open() through syscall()                 */
+#include <sys/mman.h>       /* memfd_create() for the parallel line output    */
+#include <sys/sendfile.h>   /* sendfile() for the builtin cat                 */
+#include <sys/ioctl.h>      /* FIONREAD on the pipes of a fan-out             */
+#include <sys/socket.h>     /* the Unix socket of the server mode             */
+#include <sys/un.h>         /* struct sockaddr_un                             */
+#include <arpa/inet.h>      /* htonl(), ntohl() of the frame lengths          */
+#include <sys/resource.h>   /* struct rusage of wait4(), setrlimit()          */
+#include <time.h>           /* clock_gettime() for the wall times             */
+#include <dirent.h>         /* readdir() of the memo cache                    */
+#ifdef __SSE2__
+#include <emmintrin.h>      /* SSE2 intrinsics for the delimiter scanner      */
+#endif
+
+extern char **environ;      /* environment passed to posix_spawnp()           */
 
 /*
  *******************************************************************************
  * DEFINES                                                                     *
  *******************************************************************************
  */
-#define BUFFER_SIZE 1024
-#define MAX_LINE_SIZE 512
+#define TOKENS_INIT 64      /* first size of the token array, it doubles      */
 #define SPACE_DELIM " \t\r\n\a"
-#define MAX_CMD_NUM 256
+#define OPERATOR_CHARS ";&|<>"
+#define CHAR_SPACE 1        /* classes of the bytes that end a plain word     */
+#define CHAR_OP 2
+#define CHAR_QUOTE 3
+#define TOK_END 0           /* types of the tokens made by parseLine()        */
+#define TOK_WORD 1
+#define TOK_OP 2
 #define GREEN "\033[0;32m"
 #define GREEN_BOLD "\033[1;32m"
 #define RED "\033[0;31m"
 #define YELLOW "\033[0;33m"
 #define RESET_COLOR "\033[0m"
+#define SPAWN_FORK 0        /* fork() + execvp() in the child                 */
+#define SPAWN_POSIX 1       /* posix_spawnp() (vfork-like, no page copies)    */
+#define SPAWN_ZYGOTE 2      /* exec'ed by a helper forked ahead of time       */
+#define ZYGOTE_POOL 4       /* idle helpers kept by -s zygote                 */
+#define ZYGOTE_MSG 65536    /* largest launch request, else posix_spawn()     */
+#define SPAWN_ENV "MYSHELL_SPAWN"
+#define BUILTIN_PIPE_OK 0   /* may run inside the shell as a pipeline stage   */
+#define BUILTIN_SPECIAL 1   /* changes shell state, forked inside a pipeline  */
+#define HASH_BUCKETS 256    /* buckets of the command path hash table         */
+#define ARENA_BLOCK 65536   /* default size of an arena block                 */
+#define NO_WORD -1          /* no '<' or '>' target in a Command              */
+#define OP_END 0            /* last pipeline of the line                      */
+#define OP_SEQ 1            /* ';'  : the next pipeline always runs           */
+#define OP_AND 2            /* '&&' : the next pipeline runs on exit status 0 */
+#define JOB_RUNNING 0       /* states of a background job                     */
+#define JOB_STOPPED 1
+#define JOB_DONE 2
+#define JOBS_KEEP_DONE 256  /* finished jobs remembered for a later wait     */
+#define SLOT_FREE 0         /* states of a parallel batch line                */
+#define SLOT_WAITING 1
+#define SLOT_RUNNING 2
+#define SLOT_DONE 3
+#define BATCH_WINDOW 4      /* lines buffered per worker for ordered output   */
+#define COPY_BUF 65536      /* chunk used to flush the buffered output        */
+#define READ_WINDOW 1048576 /* bytes read at a time from a batch on a pipe    */
+#define READ_KEEP 4194304   /* mapped batch bytes kept behind the line, 2^n   */
+#define COPY_CHUNK 1073741824/* bytes asked of one zero-copy call             */
+#define STATS_TOP 20        /* slowest lines listed by --stats                */
+#define STATS_TEXT 48       /* characters of a line shown by --stats          */
+#define SUPER_EVENTS 64     /* epoll events handled per wake-up               */
+#define EV_SIGCHLD -1       /* epoll tags of the fds that are not pidfds      */
+#define EV_INPUT -2
+#define TIMEOUT_STATUS 124  /* exit status of a pipeline that timed out       */
+#define TIMEOUT_GRACE 1000000 /* us from SIGTERM to SIGKILL on a timeout      */
+#define CGROUP_ENV "MYSHELL_CGROUP"
+#define CPU_PERIOD 100000   /* us, cpu.max period of a limited pipeline       */
+#define NO_NICE 99          /* a 'sched' without nice=                        */
+#define IOPRIO_WHO_PROCESS 1/* ioprio_set() arguments, see linux/ioprio.h     */
+#define IOPRIO_CLASS_SHIFT 13
+#define FRAME_HEAD 5        /* type byte and payload length of a frame        */
+#define FRAME_MAX 65536     /* largest payload of a frame                     */
+#define FRAME_SCRIPT 'S'    /* client: part of the script                     */
+#define FRAME_RUN 'R'       /* client: last part of the script, run it        */
+#define FRAME_OUT 'O'       /* server: stdout of the script                   */
+#define FRAME_ERR 'E'       /* server: stderr of the script                   */
+#define FRAME_EXIT 'X'      /* server: exit status, the request is over       */
+#define PLAN_SUFFIX ".plan" /* --compile writes batchfile.plan                */
+#define PLAN_MAGIC "MYSHPLN2"
+#define PLAN_ALIGN 16       /* every item of a plan starts at such an offset  */
+#define MEMO_ENV "MYSHELL_MEMO"
+#define MEMO_MAGIC "MYSHMEM1"
+#define MEMO_MAX 268435456  /* bytes of the memo cache when there is no -M    */
+#define MEMO_KEY 65536      /* longest key, a longer pipeline is not memoized */
+#define MEMO_SETTLE 1000000000LL /* ns, newer inputs are run but not cached */
+#define MEMO_VARS "PATH", "LANG", "LC_ALL", "LC_CTYPE", "LC_COLLATE", \
+                  "LC_NUMERIC", "TZ" /* the environment in the memo key      */
+#define PREFIX_TEXT 4096    /* longest prefix of a command that jobs shows    */
+#define TRACE_ENV "MYSHELL_TRACE"
+#define TRACE_EVENT 512     /* longest trace event written in one write()     */
+#define TRACING __builtin_expect(trace_fd >= 0, 0) /* the only cost when off  */
+
+/*
+ *******************************************************************************
+ * Types                                                                       *
+ *******************************************************************************
+ */
+typedef int (*builtinFn)(char **args);
+
+typedef struct
+{
+	const char *name;
+	builtinFn   fn;
+	int         flags;          /* BUILTIN_PIPE_OK or BUILTIN_SPECIAL       */
+} Builtin;
+
+typedef struct ArenaBlock
+{
+	struct ArenaBlock *next;
+	size_t             size;    /* usable bytes in data                      */
+	size_t             used;
+	char               data[];
+} ArenaBlock;
+
+typedef struct
+{
+	ArenaBlock *head;           /* blocks are kept across arenaReset()       */
+	ArenaBlock *current;        /* block that allocations are served from    */
+} Arena;
+
+typedef struct
+{
+	char *text;                 /* NUL ended, quotes already removed         */
+	int   type;                 /* TOK_WORD, TOK_OP or TOK_END               */
+} Token;
+
+typedef struct
+{
+	cpu_set_t cpus;             /* cpu=: CPUs it may run on, none for any    */
+	int       nice;             /* nice=: -20..19, or NO_NICE                */
+	int       policy;           /* policy=: SCHED_OTHER, _BATCH, _IDLE or -1 */
+	int       ioprio;           /* io=: value for ioprio_set(), or -1        */
+} Sched;
+
+typedef struct
+{
+	int argv;                   /* first word of the NULL ended argv         */
+	int argc;
+	int in;                     /* word of the '<' target or NO_WORD         */
+	int out;                    /* word of the '>' target or NO_WORD         */
+	Sched *sched;               /* 'sched ... --' prefix, or NULL            */
+} Command;
+
+typedef struct
+{
+	long long mem;              /* bytes: memory.max, else RLIMIT_AS         */
+	long long cpu;              /* seconds of CPU time of every process      */
+	long long nproc;            /* RLIMIT_NPROC                              */
+	long long cpus;             /* thousandths of a CPU, for cpu.max         */
+} Limits;                       /* 0 in a field: no limit                    */
+
+typedef struct
+{
+	int cmd;                    /* first Command of the pipeline             */
+	int ncmds;                  /* stages, connected with '|'                */
+	int op;                     /* OP_END, OP_SEQ or OP_AND after it         */
+	int bg;                     /* its and-or list ends with '&'             */
+	int timed;                  /* prefixed with 'time'                      */
+	int memo;                   /* prefixed with 'memo'                      */
+	long long timeout_us;       /* 'timeout SECS' prefix, 0 for none         */
+	Limits   *limits;           /* 'limit ... --' prefix, or NULL            */
+	long      pipe_size;        /* 'pipesize SIZE' prefix, 0 for -B          */
+	int       fanout;           /* commands of '|& {...}' at its end, or 0   */
+} Pipeline;
+
+typedef struct
+{
+	char    **words;            /* argvs and redirect targets of the line    */
+	Command  *cmds;
+	Pipeline *pipes;
+	int       nwords;
+	int       ncmds;
+	int       npipes;
+	char     *note;             /* text of a '#@' annotation, or NULL        */
+} Ast;
+
+typedef struct
+{
+	char **argv;
+	int    in_fd;               /* pipe end that becomes stdin, or -1        */
+	int    out_fd;              /* pipe end that becomes stdout, or -1       */
+	char  *in_file;             /* '<' target or NULL                        */
+	char  *out_file;            /* '>' target or NULL                        */
+	pid_t  pgid;                /* -1: shell's group, 0: new group, >0: join */
+	const Limits *limits;       /* set in the child before exec, or NULL     */
+	int    cg_fd;               /* cgroup.procs the child joins, or -1       */
+	const Sched *sched;         /* set in the child before exec, or NULL     */
+	int    cpu;                 /* -p: CPU the stage is pinned to, or -1     */
+	int    lane;                /* trace lane: pipeline stage + 1            */
+	long long start_us;         /* traced: when the child was started        */
+} Launch;
+
+typedef struct
+{
+	int    id;                  /* [id] as printed by jobs                   */
+	pid_t  pgid;                /* process group of the whole job            */
+	pid_t *pids;                /* processes of the job, -1 once reaped      */
+	int    npids;
+	int    live;                /* processes not reaped yet                  */
+	int    state;               /* JOB_RUNNING, JOB_STOPPED or JOB_DONE      */
+	int    exit_status;         /* of the last process, once JOB_DONE        */
+	char  *text;                /* command line shown by jobs                */
+} Job;
+
+typedef struct
+{
+	Job  **jobs;                /* ordered by start, most recent last        */
+	int    njobs;
+	int    capacity;
+} JobTable;
+
+typedef struct
+{
+	long long real_us;          /* wall time                                 */
+	long long user_us;          /* CPU time of the children                  */
+	long long sys_us;
+	long      maxrss;           /* kB, of the largest child                  */
+	long      nvcsw;            /* voluntary context switches                */
+	long      nivcsw;           /* involuntary context switches              */
+	long      cg_peak;          /* kB, memory.peak of the largest cgroup     */
+} Usage;
+
+typedef struct
+{
+	unsigned long lineno;
+	Usage         usage;
+	char          text[STATS_TEXT + 1];
+} LineStat;
+
+typedef struct
+{
+	int           enabled;      /* --stats                                   */
+	unsigned long lines;        /* lines measured                            */
+	Usage         total;
+	LineStat      top[STATS_TOP]; /* slowest lines, slowest first           */
+	int           ntop;
+} Stats;
+
+typedef struct
+{
+	pid_t  pid;                 /* worker running the line, -1 for none      */
+	int    pidfd;               /* its pidfd in the supervisor, or -1        */
+	int    state;               /* SLOT_FREE, SLOT_WAITING, ... SLOT_DONE    */
+	int    out_fd;              /* memfds that buffer the stdout and the     */
+	int    err_fd;              /* stderr of the line until it is flushed    */
+	unsigned long lineno;       /* line of the batchfile                     */
+	Arena  arena;               /* the line's AST lives until it has run     */
+	Ast    ast;
+	char **reads;               /* files the line reads (-d)                 */
+	char **writes;              /* files the line writes or may write (-d)   */
+	int    nreads;
+	int    nwrites;
+	unsigned long *deps;        /* earlier lines that must finish first      */
+	int    ndeps;
+	char  *text;                /* the line, for --stats                     */
+	size_t len;
+	long long start_us;         /* when the worker was started               */
+} BatchSlot;
+
+typedef struct
+{
+	int        jobs;            /* lines in flight, 1 for a serial batch     */
+	int        tag;             /* prefix the output with the line number    */
+	int        dag;             /* order the lines by the files they use     */
+	BatchSlot *slots;           /* ring of jobs * BATCH_WINDOW lines         */
+	int        nslots;
+	int        running;
+	int        pending;         /* lines read that are waiting or running    */
+	unsigned long head;         /* oldest line that is not flushed yet       */
+	unsigned long next;         /* next line to start                        */
+	int        saved_out;       /* the shell's own stdout and stderr         */
+	int        saved_err;
+} Batch;
+
+typedef struct
+{
+	int    fd;
+	char  *map;                 /* the mapped batchfile, or NULL             */
+	char  *buf;                 /* else the window the batch is read into    */
+	size_t size;                /* bytes of map, or bytes read into buf      */
+	size_t cap;                 /* bytes allocated for buf                   */
+	size_t pos;                 /* start of the next line in map or buf      */
+	size_t dropped;             /* bytes of map given back with madvise()    */
+	int    eof;                 /* read() has returned 0                     */
+} Reader;
+
+typedef struct
+{
+	char      magic[8];         /* PLAN_MAGIC                                */
+	size_t    sizes[5];         /* of the types stored, to refuse old plans  */
+	dev_t     dev;              /* the batchfile it was compiled from        */
+	ino_t     ino;
+	off_t     size;
+	long long mtime_ns;
+	Limits    limits;           /* -l, that parseArgs() copies into 'limit'  */
+	size_t    lines;            /* PlanLines that follow, one per line       */
+} PlanHead;
+
+typedef struct
+{
+	size_t        next;         /* offset of the next PlanLine               */
+	unsigned long lineno;
+	size_t        len;
+	char         *text;         /* the line, for --stats                     */
+	Ast           ast;          /* npipes is 0 for an empty line             */
+} PlanLine;                     /* pointers are offsets from the plan start  */
+
+typedef struct
+{
+	char  *base;                /* the mapped plan, NULL when lines are read */
+	size_t size;                /* its bytes, or the buffer of --compile     */
+	size_t next;                /* offset of the next PlanLine to run        */
+	size_t lines;               /* PlanLines left                            */
+	const PlanLine *line;       /* the one planLine() returned last          */
+} Plan;
+
+typedef struct
+{
+	char   magic[8];            /* MEMO_MAGIC                                */
+	size_t key_len;             /* then the key, then the cached stdout      */
+	size_t out_len;
+	int    status;              /* exit status of the pipeline               */
+} MemoHead;
+
+typedef struct
+{
+	char      name[17];         /* hash of the key, 16 hex digits            */
+	off_t     size;
+	long long used_ns;          /* mtime, set again on every hit             */
+} MemoFile;
+
+typedef struct HashEntry
+{
+	struct HashEntry *next;
+	unsigned long     hits;
+	char             *path;     /* resolved absolute path of the command     */
+	char              name[];   /* command name as typed, path follows it    */
+} HashEntry;
+
+typedef struct
+{
+	HashEntry    *buckets[HASH_BUCKETS];
+	char         *path_env;     /* copy of $PATH the entries were found with */
+	unsigned long hits;
+	unsigned long misses;
+} HashTable;
+
+typedef struct
+{
+	pid_t pid;                  /* idle helper, a child of the shell         */
+	int   sock;                 /* shell's end of its SOCK_SEQPACKET pair    */
+} Zygote;
+
+typedef struct
+{
+	Zygote idle[ZYGOTE_POOL];
+	int    nidle;
+	int    spent[ZYGOTE_POOL];  /* sockets of used helpers, closed later     */
+	int    nspent;
+	pid_t  owner;               /* the process whose children they are       */
+} ZygotePool;
+
+typedef struct
+{
+	pid_t pgid;                 /* as in Launch                              */
+	int   argc;
+	int   has_in;               /* a '<' target follows the cwd              */
+	int   has_out;              /* a '>' target follows that                 */
+} ZygoteMsg;                    /* then path, cwd, targets, argv: NUL ended  */
+
+/*
+ *******************************************************************************
+ * Global settings                                                             *
+ *******************************************************************************
+ */
+static int spawn_mode = SPAWN_POSIX; /* process launch backend                */
+static HashTable cmd_hash;           /* command name -> absolute path         */
+static ZygotePool zygotes;           /* -s zygote: helpers ready to exec      */
+static JobTable job_table;           /* background jobs                       */
+static int sigchld_pipe[2] = {-1, -1}; /* self-pipe written on SIGCHLD       */
+static int interactive = 0;          /* reading commands from a terminal      */
+static int sigchld_pending = 0;      /* self-pipe drained outside reapJobs()  */
+static volatile sig_atomic_t sigchld_seen = 0; /* SIGCHLD since reapJobs()   */
+static int super_fd = -1;            /* epoll set of the child supervisor     */
+static int input_ready = 0;          /* the terminal has input to read        */
+static long long line_timeout = 0;   /* -w: time limit of every line, in us   */
+static long long line_deadline = 0;  /* nowUs() when the current line is over */
+static long long wait_deadline = 0;  /* nowUs() when 'wait' and 'fg' give up  */
+static Limits limits_default;        /* -l: limits of every pipeline          */
+static int cg_state = 0;             /* cgroups: 0 not looked for, 1 ok, -1 no */
+static unsigned long cg_jobs = 0;    /* cgroups made so far, for their names  */
+static int pin_mode = 0;             /* -p: pin pipeline stages to near CPUs  */
+static int *pin_order = NULL;        /* allowed CPUs, siblings side by side   */
+static int pin_ncpus = -1;           /* -1 until pinInit() has looked         */
+static long pipe_size = 0;           /* -B: capacity of the pipes, 0: default */
+static int pipe_stats = 0;           /* -R: relay and measure every pipe      */
+static const char *server_path = NULL; /* -L: socket of the server mode      */
+static int compile_mode = 0;         /* -C: write the plan of the batchfile   */
+static Plan plan;                    /* the batchfile's plan, if it is fresh  */
+static long long memo_max = MEMO_MAX;/* -M: bytes kept in the memo cache      */
+static long long memo_used = -1;     /* bytes in it, -1 until memoTrim()      */
+static unsigned long launch_errors;  /* stages launchCmd() could not start    */
+static Reader reader;                /* lines of a batch that is not a plan   */
+static Batch batch = {1, 0, 0, NULL, 0, 0, 0, 0, 0, -1, -1}; /* -j, -d     */
+static Usage usage;                  /* children waited for in this line      */
+static Stats stats;                  /* --stats summary of the batch          */
+static int trace_fd = -1;            /* --trace file, -1 when not tracing     */
+static long long trace_last;         /* end of the last traced phase          */
+static int trace_lanes;              /* stage lanes named so far              */
 
 /*
  *******************************************************************************
@@ -39,19 +446,218 @@
  *******************************************************************************
  */
 void   mainLoop         (int argc, const char *argv[]);
+int    parseOptions     (int argc, const char *argv[]);
+int    setSpawnMode     (const char *name);
+long long parseSeconds  (const char *text);
 void   printPromptName  (void);
 void   quitShell        (void);
 FILE*  chooseInput      (int argc, const char *argv[]);
-char*  readLine         (FILE* input);
-char** parseLine        (char *line);
-int    checkArgs        (char **args);
-int    parseArgs        (char **args, char **cmd_args);
-int    executeCmd       (char **args);
-void   executeAll       (char **args);
-void   executeRecursive (char **args, char **cmd_args);
-int    executeRedirect  (char **args, char **cmd_args, int redirect_mode);
-void   shiftLeftArgs    (char **args);
-int    executePipe      (char **args, char **cmd_args);
+char*  readLine         (FILE* input, size_t *len);
+void   readerOpen       (int fd);
+char*  readerLine       (size_t *len);
+void   quitBatch        (void);
+int    parseAll         (const char *line, size_t len, Ast *ast, Arena *arena);
+int    planCompile      (const char *file);
+void   planStore        (unsigned long lineno, const char *line, size_t len,
+                         const Ast *ast);
+size_t planPut          (const void *data, size_t len, size_t align);
+void   planStamp        (PlanHead *head, const struct stat *st);
+void   planOpen         (const char *file, FILE *input);
+int    planCheck        (void);
+void*  planAddr         (void *offset, size_t len, size_t align, int *bad);
+char*  planLine         (size_t *len, unsigned long *lineno);
+int    planParse        (Ast *ast, Arena *arena);
+void   batchInit        (void);
+void   batchLine        (const char *line, size_t len);
+int    batchNeedsShell  (Ast *ast);
+BatchSlot* batchSlot    (void);
+void   batchStart       (void);
+int    batchReady       (BatchSlot *slot);
+void   batchRun         (BatchSlot *slot);
+void   batchDeps        (BatchSlot *slot);
+void   batchFiles       (BatchSlot *slot);
+int    batchConflict    (BatchSlot *later, BatchSlot *earlier);
+int    fileIn           (const char *file, char **files, int nfiles);
+const char* fileKey     (const char *file);
+void   batchCapture     (BatchSlot *slot);
+void   batchRestore     (void);
+void   batchWait        (int block);
+void   batchFlush       (int all);
+void   copyOutput       (int fd, int to, unsigned long lineno);
+int    writeAll         (int fd, const char *buf, size_t len);
+int    readAll          (int fd, char *buf, size_t len);
+void   serverLoop       (const char *path);
+void   serveClient      (int fd);
+int    runRequest       (int fd, const char *script, size_t len);
+int    sendFrame        (int fd, char type, char *frame, size_t len);
+Token* parseLine        (const char *line, size_t len, Arena *arena);
+size_t scanSpecial      (const char *p, size_t n);
+int    checkArgs        (Token *args);
+int    parseArgs        (Token *args, Ast *ast, Arena *arena);
+int    endCommand       (Ast *ast, char *in_file, char *out_file);
+void*  arenaAlloc       (Arena *arena, size_t size);
+void   arenaReset       (Arena *arena);
+int    isOp             (const Token *token, const char *op);
+int    executeAll       (Ast *ast);
+int    executeList      (Ast *ast, int first, int last);
+int    executeBackground(Ast *ast, int first, int last);
+int    executeCmd       (Ast *ast, Command *cmd);
+int    executePipe      (Ast *ast, Pipeline *pipeline, pid_t *bg_pids);
+int    executeRedirect  (int in_fd, int out_fd, char *in_file, char *out_file);
+void   setLaunch        (Launch *launch, Ast *ast, Command *cmd);
+long long pipeDeadline  (Pipeline *pipeline);
+void   killPipe         (pid_t pgid, pid_t *pids, int n, int *statuses,
+                         long long *ended);
+int    exitStatus       (int status);
+int    prefixEnd        (Token *args, int i);
+int    parseLimits      (Limits *limits, const char *spec);
+long long parseSize     (const char *text, char **end);
+void   setPipeSize      (int fd, long size);
+int    relayPipe        (int in_fd, int n, pid_t pgid, const char *from,
+                         const char *to, long size, pid_t *pid);
+int    fanPipe          (int in_fd, int n, pid_t pgid, long size, int *fds,
+                         pid_t *pid);
+int    spliceAll        (int from, int to, size_t len);
+int    teeAll           (int from, int *copy, int to, int null_fd,
+                         size_t len);
+const Limits* pipeLimits(Pipeline *pipeline);
+void   applyLimits      (const Launch *launch);
+void   lowerLimit       (int resource, rlim_t soft, rlim_t hard);
+const char* cgroupRoot  (void);
+int    cgroupOpen       (const Limits *limits, char *dir);
+void   cgroupClose      (const char *dir, int fd, const char *name);
+int    cgroupWrite      (const char *dir, const char *file, const char *value);
+int    cgroupRead       (const char *dir, const char *file, char *buf,
+                         size_t size);
+int    parseSched       (Sched *sched, const char *spec);
+int    parseCpus        (const char *list, cpu_set_t *cpus);
+void   applySched       (const Launch *launch);
+void   pinInit          (void);
+int    pinBase          (void);
+long   readLong         (const char *path);
+int    timePipe         (Ast *ast, Pipeline *pipeline);
+int    memoPipe         (Ast *ast, Pipeline *pipeline);
+int    memoKey          (Ast *ast, Pipeline *pipeline, char *key, size_t *len,
+                         long long *newest);
+int    memoStat         (char *key, size_t *len, const char *tag,
+                         const struct stat *st, long long *newest);
+int    memoAdd          (char *key, size_t *len, const char *text);
+const char* memoDir     (void);
+int    memoHit          (const char *path, const char *key, size_t len,
+                         MemoHead *head);
+void   memoTrim         (const char *dir);
+int    memoOlder        (const void *a, const void *b);
+long long nowUs         (void);
+void   addUsage         (Usage *sum, const Usage *add);
+void   addRusage        (Usage *sum, const struct rusage *ru);
+void   printUsage       (const Usage *u);
+void   recordLine       (unsigned long lineno, const char *line, size_t len,
+                         const Usage *u);
+void   printStats       (void);
+void   traceOpen        (const char *file);
+void   traceClose       (void);
+void   traceMark        (const char *name, int lane, pid_t child);
+void   traceEvent       (const char *name, int lane, long long start_us,
+                         long long end_us, pid_t child);
+void   traceName        (const char *kind, int lane, const char *name);
+void   setupSignals     (void);
+void   defaultSignals   (sigset_t *set);
+void   resetSignals     (void);
+void   sigchldHandler   (int sig);
+void   reapJobs         (void);
+void   superInit        (void);
+int    superWatch       (pid_t pid);
+void   superForget      (int pidfd);
+void   superWait        (int timeout_ms);
+int    superReap        (pid_t *pids, int n, int *statuses, long long *ended,
+                         long long deadline_us);
+void   superIdle        (void);
+void   notifyJobs       (void);
+Job*   addJob           (pid_t *pids, int npids, char *text);
+Job*   findJob          (const char *spec);
+int    waitJob          (Job *job);
+void   removeJob        (Job *job);
+char*  jobText          (Ast *ast, int first, int last);
+char*  prefixText       (const Pipeline *pipeline, char *buf, size_t size);
+char*  schedText        (const Sched *sched, char *buf, size_t size);
+char*  sizeText         (long long size, char *buf);
+pid_t  launchCmd        (Launch *launch);
+int    spawnPosix       (const char *path, Launch *launch, pid_t *pid);
+int    spawnFork        (const char *path, Launch *launch, pid_t *pid);
+int    spawnZygote      (const char *path, Launch *launch, pid_t *pid);
+void   zygoteFill       (void);
+void   zygoteCheck      (void);
+void   zygoteFlush      (void);
+void   zygoteMain       (int sock);
+const char* hashLookup  (const char *name, int *cached);
+void   hashForget       (const char *name);
+void   hashClear        (void);
+HashEntry* hashAdd      (const char *name, const char *path);
+void   hashSend         (int fd);
+void   hashRecv         (int fd);
+unsigned int hashName   (const char *name);
+const Builtin* findBuiltin (const char *name);
+int    runBuiltin       (const Builtin *builtin, Launch *launch);
+pid_t  forkBuiltin      (const Builtin *builtin, Launch *launch);
+int    builtinCd        (char **args);
+int    builtinPwd       (char **args);
+int    builtinEcho      (char **args);
+int    builtinCat       (char **args);
+int    copyFd           (int in_fd, int out_fd);
+int    runProgram       (char **argv);
+int    builtinTrue      (char **args);
+int    builtinFalse     (char **args);
+int    builtinTest      (char **args);
+int    builtinQuit      (char **args);
+int    builtinHash      (char **args);
+int    builtinExport    (char **args);
+int    builtinUnset     (char **args);
+int    builtinJobs      (char **args);
+int    builtinWait      (char **args);
+int    builtinFg        (char **args);
+int    builtinBarrier   (char **args);
+int    testExpr         (int argc, char **args);
+
+/*
+ *******************************************************************************
+ * Classes of the bytes that parseLine() has to stop at inside a word.         *
+ *******************************************************************************
+ */
+static const unsigned char char_class[256] =
+{
+	[' '] = CHAR_SPACE, ['\t'] = CHAR_SPACE, ['\r'] = CHAR_SPACE,
+	['\n'] = CHAR_SPACE, ['\a'] = CHAR_SPACE,
+	[';'] = CHAR_OP, ['&'] = CHAR_OP, ['|'] = CHAR_OP, ['<'] = CHAR_OP,
+	['>'] = CHAR_OP,
+	['"'] = CHAR_QUOTE, ['\''] = CHAR_QUOTE, ['\\'] = CHAR_QUOTE
+};
+
+/*
+ *******************************************************************************
+ * Builtins' table. It is searched before any fork so that these commands run  *
+ * inside the shell process.                                                   *
+ *******************************************************************************
+ */
+static const Builtin builtins[] =
+{
+	{"cd",    builtinCd,    BUILTIN_SPECIAL},
+	{"pwd",   builtinPwd,   BUILTIN_PIPE_OK},
+	{"echo",  builtinEcho,  BUILTIN_PIPE_OK},
+	{"cat",   builtinCat,   BUILTIN_PIPE_OK},
+	{"true",  builtinTrue,  BUILTIN_PIPE_OK},
+	{"false", builtinFalse, BUILTIN_PIPE_OK},
+	{"test",  builtinTest,  BUILTIN_PIPE_OK},
+	{"[",     builtinTest,  BUILTIN_PIPE_OK},
+	{"quit",  builtinQuit,  BUILTIN_SPECIAL},
+	{"hash",  builtinHash,  BUILTIN_SPECIAL},
+	{"export",builtinExport,BUILTIN_SPECIAL},
+	{"unset", builtinUnset, BUILTIN_SPECIAL},
+	{"jobs",  builtinJobs,  BUILTIN_PIPE_OK},
+	{"wait",  builtinWait,  BUILTIN_SPECIAL},
+	{"fg",    builtinFg,    BUILTIN_SPECIAL},
+	{"barrier",builtinBarrier,BUILTIN_PIPE_OK},
+	{NULL,    NULL,         0}
+};
 
 /*
  *******************************************************************************
@@ -73,34 +679,312 @@ int main(int argc, const char *argv[])
  */
 void mainLoop(int argc, const char *argv[])
 {
+	int first_arg = parseOptions(argc, argv);
+	if(server_path != NULL)
+	{
+		serverLoop(server_path); //-L: requests come from the socket.
+	}
+	if(compile_mode)
+	{
+		exit(planCompile(argv[first_arg]));
+	}
 	printf("Welcome to my Shell! My name is Vasileios Amoiridis and I am the creator.\n");
-	FILE* input = chooseInput(argc, argv);
+	FILE* input = chooseInput(argc - first_arg + 1, argv + first_arg - 1);
 	char* line = NULL;
-	char** args = NULL;
-	int exit_status = 0, check_status = 0;
-	int i = 1;
+	Arena arena = {NULL, NULL}; //backs everything that lives for one line.
+	size_t len = 0;
+	unsigned long lineno = 0;
+	long long start_us = 0;
+	Ast ast;
+
+	if(input != stdin)
+	{
+		planOpen(argv[first_arg], input); //a fresh plan is run, not parsed.
+	}
+	interactive = (input == stdin && isatty(STDIN_FILENO));
+	if(!interactive && plan.base == NULL)
+	{
+		readerOpen(fileno(input));
+	}
+	setupSignals();
+	superInit();
+	if(spawn_mode == SPAWN_ZYGOTE)
+	{
+		zygotes.owner = getpid(); //forked shells keep to posix_spawn().
+		zygoteFill();
+	}
+	if(interactive)
+	{
+		batch.jobs = 1; //-j only makes sense for a batch.
+	}
+	batchInit();
 
 	do
 	{
+		arenaReset(&arena); //the previous line is done, reuse its memory.
+		reapJobs(); //collect the background jobs that SIGCHLD reported.
+		notifyJobs();
 		if(input == stdin)
 		{
 			printPromptName();
 		}
 
-		line = readLine(input);
-		if(!strcmp(line,"\n")) continue; //if line is empty just jump to the
-		//next line.
+		if (plan.base != NULL)
+		{
+			line = planLine(&len, &lineno); //parsed by --compile.
+			if (TRACING) traceMark("planLine", 0, 0);
+		}
+		else
+		{
+			line = readLine(input, &len);
+			lineno++;
+			if (TRACING) traceMark("readLine", 0, 0);
+		}
+		if (batch.jobs > 1)
+		{
+			//runs it in a worker slot.
+			batchLine(line, len);
+			continue;
+		}
 
-		args = parseLine(line);
-		if (checkArgs(args)) continue; //if there is a false argument jump to
-		//next line.
+		if ((plan.base != NULL) ? planParse(&ast, &arena) :
+		    parseAll(line, len, &ast, &arena)) continue; //if line is empty
+		//or has a false argument jump to the next line.
 
-		executeAll(args);
+		if (stats.enabled)
+		{
+			memset(&usage, 0, sizeof(usage));
+			start_us = nowUs();
+		}
+		executeAll(&ast);
+		if (stats.enabled)
+		{
+			usage.real_us = nowUs() - start_us;
+			recordLine(lineno, line, len, &usage);
+		}
 
 	} while(1);
 	
 }
 
+/*
+ *******************************************************************************
+ * parseOptions() handles the command line options which come before the       *
+ * optional batchfile name and returns the index of the first non option       *
+ * argument. The process launch backend can be chosen with -s/--spawn or with  *
+ * the MYSHELL_SPAWN environment variable (the option wins), so that the fork, *
+ * the posix_spawn and the zygote paths can be benchmarked against each other. *
+ * -j/--jobs N runs up to N batch lines at the same time (0 for one per CPU),  *
+ * -t/--tag prefixes their output with the line number and -d/--dag starts     *
+ * each line as soon as the lines whose files it uses are done. -S/--stats     *
+ * prints the resources used by the batch and its slowest lines at the end.    *
+ * -T/--trace FILE, or MYSHELL_TRACE, writes a Chrome trace of the run.        *
+ * -w/--timeout SECS kills whatever a line still runs SECS seconds after it    *
+ * started, and -l/--limit mem=..,cpu=.. gives every pipeline the limits of a  *
+ * 'limit' prefix. -p/--pin pins the stages of every pipeline to CPUs that are *
+ * next to each other. -B/--pipe-size SIZE sets the capacity of every pipe and *
+ * -R/--pipe-stats reports the bytes that went through each pipe and how long  *
+ * its ends waited. -L/--listen SOCKET turns the shell into a server that runs *
+ * the scripts of its clients (see serverLoop()). -C/--compile parses the      *
+ * batchfile and writes its plan for later runs instead of running it (see     *
+ * planCompile()). -M/--memo-size SIZE bounds the disk cache of the 'memo'     *
+ * prefix (see memoPipe()).                                                    *
+ *******************************************************************************
+ */
+int parseOptions(int argc, const char *argv[])
+{
+	static const struct option long_opts[] =
+	{
+		{"spawn", required_argument, NULL, 's'},
+		{"jobs",  required_argument, NULL, 'j'},
+		{"tag",   no_argument,       NULL, 't'},
+		{"dag",   no_argument,       NULL, 'd'},
+		{"stats", no_argument,       NULL, 'S'},
+		{"trace", required_argument, NULL, 'T'},
+		{"timeout", required_argument, NULL, 'w'},
+		{"limit", required_argument, NULL, 'l'},
+		{"pin",   no_argument,       NULL, 'p'},
+		{"pipe-size", required_argument, NULL, 'B'},
+		{"pipe-stats", no_argument,  NULL, 'R'},
+		{"listen", required_argument, NULL, 'L'},
+		{"compile", no_argument,     NULL, 'C'},
+		{"memo-size", required_argument, NULL, 'M'},
+		{NULL,    0,                 NULL,  0 }
+	};
+	const char *env = getenv(SPAWN_ENV);
+	const char *trace = getenv(TRACE_ENV);
+	char *end;
+	long long size;
+	long jobs;
+	int opt;
+
+	if(env != NULL && setSpawnMode(env))
+	{
+		fprintf(stderr,RED "Invalid %s value '%s'.\n" RESET_COLOR,SPAWN_ENV,env);
+		exit(EXIT_FAILURE);
+	}
+
+	while((opt = getopt_long(argc, (char * const *)argv, "+s:j:tdST:w:l:pB:RL:CM:",
+	                         long_opts, NULL)) != -1)
+	{
+		switch (opt)
+		{
+			case 's':
+				if(setSpawnMode(optarg))
+				{
+					fprintf(stderr,RED "Invalid spawn mode '%s'. Use 'posix', "
+					        "'fork' or 'zygote'.\n" RESET_COLOR,optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'j':
+				jobs = strtol(optarg, &end, 10);
+				if(end == optarg || *end != '\0' || jobs < 0 || jobs > 4096)
+				{
+					fprintf(stderr,RED "Invalid number of jobs '%s'.\n"
+					        RESET_COLOR,optarg);
+					exit(EXIT_FAILURE);
+				}
+				if(jobs == 0) //one line per online CPU.
+				{
+					jobs = sysconf(_SC_NPROCESSORS_ONLN);
+				}
+				batch.jobs = (jobs > 0) ? (int)jobs : 1;
+				break;
+			case 't':
+				batch.tag = 1;
+				break;
+			case 'd':
+				batch.dag = 1;
+				break;
+			case 'S':
+				stats.enabled = 1;
+				break;
+			case 'T':
+				trace = optarg;
+				break;
+			case 'w':
+				line_timeout = parseSeconds(optarg);
+				if(line_timeout < 0)
+				{
+					fprintf(stderr,RED "Invalid timeout '%s'.\n" RESET_COLOR,optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'l':
+				if(parseLimits(&limits_default, optarg))
+				{
+					fprintf(stderr,RED "Invalid limit '%s'.\n" RESET_COLOR,optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'p':
+				pin_mode = 1;
+				break;
+			case 'B':
+				size = parseSize(optarg, &end);
+				if(size <= 0 || *end != '\0' || size > INT_MAX)
+				{
+					fprintf(stderr,RED "Invalid pipe size '%s'.\n" RESET_COLOR,
+					        optarg);
+					exit(EXIT_FAILURE);
+				}
+				pipe_size = (long)size;
+				break;
+			case 'R':
+				pipe_stats = 1;
+				break;
+			case 'L':
+				server_path = optarg;
+				break;
+			case 'C':
+				compile_mode = 1;
+				break;
+			case 'M':
+				memo_max = parseSize(optarg, &end);
+				if(memo_max <= 0 || *end != '\0')
+				{
+					fprintf(stderr,RED "Invalid memo size '%s'.\n" RESET_COLOR,
+					        optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			default:
+				fprintf(stderr,RED "Usage: %s [-s posix|fork|zygote] [-j N] [-t] [-d] [-S] "
+				        "[-T tracefile] [-w secs] [-l limits] [-p] [-B size] [-R] "
+				        "[-L socket] [-C] [-M size] [batchfile_name]\n" RESET_COLOR,
+				        argv[0]);
+				exit(EXIT_FAILURE);
+		}
+	}
+
+	if(server_path != NULL && optind < argc)
+	{
+		fprintf(stderr,RED "A server (-L) takes no batchfile.\n" RESET_COLOR);
+		exit(EXIT_FAILURE);
+	}
+	if(compile_mode && optind != argc - 1)
+	{
+		fprintf(stderr,RED "--compile takes one batchfile.\n" RESET_COLOR);
+		exit(EXIT_FAILURE);
+	}
+	if(trace != NULL && trace[0] != '\0')
+	{
+		traceOpen(trace);
+	}
+	if(batch.dag && batch.jobs == 1) //-d alone: one line per CPU.
+	{
+		batch.jobs = sysconf(_SC_NPROCESSORS_ONLN);
+		batch.jobs = (batch.jobs > 1) ? batch.jobs : 2;
+	}
+
+	return optind;
+}
+
+/*
+ *******************************************************************************
+ * setSpawnMode() selects the launch backend by name. Returns 1 on bad name.   *
+ *******************************************************************************
+ */
+int setSpawnMode(const char *name)
+{
+	if(!strcmp(name, "posix") || !strcmp(name, "spawn"))
+	{
+		spawn_mode = SPAWN_POSIX;
+	}
+	else if(!strcmp(name, "fork"))
+	{
+		spawn_mode = SPAWN_FORK;
+	}
+	else if(!strcmp(name, "zygote"))
+	{
+		spawn_mode = SPAWN_ZYGOTE;
+	}
+	else
+	{
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ *******************************************************************************
+ * parseSeconds() reads a time limit in seconds, which may have a fraction     *
+ * like "0.5", and returns it in microseconds, or -1 when it is not one.       *
+ *******************************************************************************
+ */
+long long parseSeconds(const char *text)
+{
+	char *end;
+	double secs = strtod(text, &end);
+
+	if(end == text || *end != '\0' || !(secs >= 0) || secs > 1e9)
+	{
+		return -1;
+	}
+	return (long long)(secs * 1000000);
+}
+
 /*
  *******************************************************************************
  * printPromptName() is a function which print the name of the prompt in the   * 
@@ -119,6 +1003,7 @@ void printPromptName()
  */
 void quitShell()
 {
+	printStats();
 	printf("Thanks for the cooperation. It's been a pleasure!\n");
 	exit(EXIT_SUCCESS);
 }
@@ -157,606 +1042,6859 @@ FILE* chooseInput(int argc, const char* argv[])
 /*
  *******************************************************************************
  * readLine() function reads either 1 line from stdin or a line from a batch   *
- * file and returns it. It checks for exceeding the maximum permitted line     *
- * size and also if the end of file is reached. It also handles the memory     *
- * allocation of the line.                                                     *
+ * file and returns it, with its length in *len. A batch comes from            *
+ * readerLine(), as a slice that is not NUL ended. At the terminal getline()   *
+ * grows one buffer that is kept between the calls, so lines of any length are *
+ * accepted and no memory is allocated once the buffer is big enough. It also  *
+ * checks if the end of file is reached.                                       *
  *******************************************************************************
  */
-char* readLine(FILE* input)
+char* readLine(FILE* input, size_t *len)
 {
-	char *line = (char*)malloc(BUFFER_SIZE * sizeof(char));
+	static char *line = NULL;
+	static size_t size = 0;
+	ssize_t read_len;
+	char *slice;
 
-	if(line == NULL)
+	if(!interactive)
 	{
-		printf("ERROR: malloc() failure.\n");
-		exit(EXIT_FAILURE);
-	}
-	if(fgets(line, BUFFER_SIZE, input) != NULL)
-	{	
-		if(strlen(line) > (MAX_LINE_SIZE + 1))
-		{	
-			printf("WARNING: Maximum permitted Line size exceeded.\n");
-			printf("         Assume line as empty.\n");
-			*line = '\0';
+		slice = readerLine(len); //no copy, see readerOpen().
+		if(slice == NULL)
+		{
+			quitBatch();
 		}
+		return slice;
 	}
-	else if (feof(input))
-	{
-		printf("EOF reached. Ciao!\n");
-		exit(EXIT_SUCCESS);
-	}
-	else
+	superIdle(); //reap the jobs that end while the user types.
+	read_len = getline(&line, &size, input);
+
+	if(read_len < 0)
 	{
-		printf("ERROR: fgets() failure.\n");
+		if (feof(input))
+		{
+			quitBatch();
+		}
+		printf("ERROR: getline() failure.\n");
 		exit(EXIT_FAILURE);
 	}
+	*len = (size_t)read_len;
 
 	return line;
 }
 
 /*
  *******************************************************************************
- * parseLine() function reads an input line and "cuts" it into several pieces  *
- * of arguments in order to save the several arguments in the commands. It     *
- * returns an array of strings which contains the seperate arguments.          *
+ * readerOpen() prepares the reader of a batch, from a batchfile or from a     *
+ * stdin that is not a terminal. A regular file is mapped, from its current    *
+ * offset on, and its lines are handed out as slices of the mapping with no    *
+ * copy; the pages behind the current line are given back every READ_KEEP      *
+ * bytes, so the memory used stays the same however big the file is. Anything  *
+ * else is read READ_WINDOW bytes at a time into one buffer, whose lines are   *
+ * handed out the same way, and the capacity of a pipe is raised so that its   *
+ * writer can run that far ahead.                                              *
  *******************************************************************************
  */
-char** parseLine(char *line)
+void readerOpen(int fd)
 {
-	char **tokens = (char**)malloc(BUFFER_SIZE * sizeof(char*));
-	char *token = NULL;
-	int token_num = 0;
+	struct stat st;
+	off_t start = lseek(fd, 0, SEEK_CUR);
+	void *map;
 
-	if(tokens == NULL)
+	reader.fd = fd;
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL); //fails on a pipe.
+	if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && start >= 0 &&
+	   st.st_size > start)
 	{
-		fprintf(stderr, "ERROR: malloc() failure.\n");
-		exit(EXIT_FAILURE);
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(map != MAP_FAILED)
+		{
+			madvise(map, st.st_size, MADV_SEQUENTIAL);
+			reader.map = (char*)map;
+			reader.size = st.st_size;
+			reader.pos = start;
+			reader.dropped = 0;
+			return;
+		}
 	}
-
-	token = strtok(line, SPACE_DELIM);
-	while(token != NULL)
+	if(fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode))
 	{
-		tokens[token_num] = token;
-		token_num++;
-		token = strtok(NULL, SPACE_DELIM);
+		setPipeSize(fd, READ_WINDOW);
 	}
-	tokens[token_num] = NULL;
-
-	return tokens;
 }
 
 /*
  *******************************************************************************
- * checkArgs() is a function which checks for possible syntax errors in the    *
- * arguments provided by the user.                                             *
+ * readerLine() returns the next line of the batch, '\n' included when there   *
+ * is one, with its length in *len, or NULL at the end. The line is not NUL    *
+ * ended and stays valid until the next call. When the mapping has no whole    *
+ * line left, the rest of the file is read as a stream from there, so a        *
+ * batchfile that grows while it runs is still read to its end.                *
  *******************************************************************************
  */
-int checkArgs(char **args)
+char* readerLine(size_t *len)
 {
-	int check_status = 0, i = 0;
-	if(!strcmp(args[0], "&") || !strcmp(args[0], ";") ||
-	   !strcmp(args[0], "<") || !strcmp(args[0], ">") || 
-	   !strcmp(args[0], "|") || !strcmp(args[0], "&&"))
+	char *line, *nl;
+	size_t drop;
+	ssize_t n;
+
+	if(reader.map != NULL)
 	{
-		printf("ERROR: Bad syntax. Unexpected first character.\n");
-		check_status = 1;
-		return check_status;
+		line = reader.map + reader.pos;
+		nl = (char*)memchr(line, '\n', reader.size - reader.pos);
+		if(nl != NULL)
+		{
+			*len = nl - line + 1;
+			reader.pos += *len;
+			if((size_t)(line - reader.map) >= reader.dropped + READ_KEEP)
+			{
+				drop = (line - reader.map) & ~(size_t)(READ_KEEP - 1);
+				madvise(reader.map + reader.dropped, drop - reader.dropped,
+				        MADV_DONTNEED); //the lines before are parsed.
+				reader.dropped = drop;
+			}
+			return line;
+		}
+		lseek(reader.fd, reader.pos, SEEK_SET); //the rest is read as a stream.
+		munmap(reader.map, reader.size);
+		reader.map = NULL;
+		reader.pos = 0;
+		reader.size = 0;
 	}
-	while(args[i] != NULL)
-	{	
-		if(strstr(args[i], ";;") != NULL)
-		{	
-			printf("ERROR: Bad syntax. Two or more ';' found sequentially\n");
-			check_status = 1;
-			return check_status;
+
+	while(1)
+	{
+		line = reader.buf + reader.pos;
+		nl = (reader.pos < reader.size) ?
+		     (char*)memchr(line, '\n', reader.size - reader.pos) : NULL;
+		if(nl != NULL || (reader.eof && reader.pos < reader.size))
+		{
+			*len = (nl != NULL) ? (size_t)(nl - line + 1)
+			                    : reader.size - reader.pos;
+			reader.pos += *len;
+			return line;
 		}
-		else if(strstr(args[i], "&&&") != NULL)
+		if(reader.eof)
 		{
-			printf("ERROR: Bad syntax. Three or more '&' found sequentially\n");
-			check_status = 1;
-			return check_status;
+			return NULL;
 		}
-		else if (i > 0)
+		if(reader.pos < reader.size)
 		{
-			if(!strcmp(args[i], args[i-1]) && (!strcmp(args[i], ";") || 
-			   !strcmp(args[i], "&&")))
-			{
-				printf("ERROR: Bad syntax. Unexpected token after ; or &&.\n");
-				check_status = 1;
-				return check_status;			
-			}
-			else if(!strcmp(args[i],"&&") && !strcmp(args[i-1],";") ||
-				    !strcmp(args[i],";") && !strcmp(args[i-1],"&&"))
+			memmove(reader.buf, line, reader.size - reader.pos); //keep the
+		}
+		reader.size -= reader.pos; //part of the line that was read already.
+		reader.pos = 0;
+		if(reader.size == reader.cap) //the first read, or a long line.
+		{
+			reader.cap = (reader.cap > 0) ? 2 * reader.cap : READ_WINDOW;
+			reader.buf = (char*)realloc(reader.buf, reader.cap);
+			if(reader.buf == NULL)
 			{
-				printf("ERROR: Bad syntax. Unexpected token after ; or &&.\n");
-				check_status = 1;
-				return check_status;	
+				fprintf(stderr,"ERROR: malloc() failure.\n");
+				exit(EXIT_FAILURE);
 			}
 		}
-		i++;
-	}
-	if(!strcmp(args[i-1], ";") || !strcmp(args[i-1], "&") ||
-	   !strcmp(args[i-1], "<") || !strcmp(args[i-1], ">") ||
-	   !strcmp(args[i-1], "|") || !strcmp(args[i-1], "&&"))
-	{
-		printf("ERROR: Bad syntax. Unexpected last token.\n");
-		check_status = 1;
-		return check_status;
+		n = read(reader.fd, reader.buf + reader.size, reader.cap - reader.size);
+		if(n < 0 && errno != EINTR)
+		{
+			printf("ERROR: read() failure.\n");
+			exit(EXIT_FAILURE);
+		}
+		reader.size += (n > 0) ? n : 0;
+		reader.eof = (n == 0);
 	}
+}
 
-	return check_status;
+/*
+ *******************************************************************************
+ * quitBatch() ends the shell at the end of its batchfile, once the parallel   *
+ * lines are done.                                                             *
+ *******************************************************************************
+ */
+void quitBatch(void)
+{
+	batchWait(-1); //the parallel lines still running.
+	printStats();
+	printf("EOF reached. Ciao!\n");
+	exit(EXIT_SUCCESS);
 }
 
 /*
  *******************************************************************************
- * parseArgs() is a function which has as input the arguments that were in the * 
- * line and outputs an integer with the execute status of the commands         *
- * regarding the special characters that were found in them. Moreover is a     *
- * function which takes as an input the cmd_args and the args. Both of the are *
- * arrays of strings which are about to be executed. The variable cmd_args     *
- * contains the command that is to be executed, and the variale args contaings *
- * the arguments after the special character. For example in a situation that  *
- * we have ``` echo hello && ls -l ; pwd ``` then                              *
- * cmd_args = echo hello                                                       *
- * args = ls -l ; pwd                                                          *
- * execute_status = 2
+ * parseAll() turns one line into an AST with parseLine(), checkArgs() and     *
+ * parseArgs(). It returns 0 when there is something to execute, -1 for an     *
+ * empty line and 1 for a bad one, whose error is already printed. Each phase  *
+ * is a trace event when tracing.                                              *
  *******************************************************************************
  */
-int parseArgs(char **args, char **cmd_args)
+int parseAll(const char *line, size_t len, Ast *ast, Arena *arena)
 {
-	char **temp = (char**)malloc(MAX_CMD_NUM * sizeof(char*));
-	int i = 0, cnt1 = 0, cnt2 = 0, cnt3 = 0, cnt4 = 0, cnt5 = 0, execute_status = 0;
+	Token* args = parseLine(line, len, arena);
+	int bad;
 
-	while(cmd_args[cnt1] != NULL)
-	{
-		cmd_args[cnt1] = NULL;
-		cnt1++;
+	if (TRACING) traceMark("parseLine", 0, 0);
+	if (args == NULL) return 1; //unterminated quote, already reported.
+	if (args[0].type == TOK_END) return -1; //empty line.
+	bad = checkArgs(args);
+	if (TRACING) traceMark("checkArgs", 0, 0);
+	if (bad) return 1;
+	bad = parseArgs(args, ast, arena);
+	if (TRACING) traceMark("parseArgs", 0, 0);
+
+	return bad;
+}
+
+/*
+ *******************************************************************************
+ * planCompile() is -C/--compile. It parses every line of the batchfile and,   *
+ * when none of them is bad, writes their ASTs to batchfile.plan, so that      *
+ * later runs of the batchfile skip the parsing (see planOpen()). The errors   *
+ * of all the bad lines are printed, each followed by its line, and then no    *
+ * plan is written. It returns the exit status of the shell.                   *
+ *******************************************************************************
+ */
+int planCompile(const char *file)
+{
+	char path[PATH_MAX], tmp[PATH_MAX], *line = NULL;
+	FILE *input = fopen(file, "r");
+	Arena arena = {NULL, NULL};
+	unsigned long lineno = 0, nbad = 0;
+	size_t size = 0;
+	ssize_t len;
+	PlanHead head;
+	struct stat st;
+	Ast ast;
+	int bad, fd;
+
+	if(input == NULL || fstat(fileno(input), &st) < 0)
+	{
+		perror(file);
+		return EXIT_FAILURE;
+	}
+	if(snprintf(path, sizeof(path), "%s" PLAN_SUFFIX, file) >= (int)sizeof(path)
+	   || snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp))
+	{
+		fprintf(stderr,RED "The name '%s' is too long.\n" RESET_COLOR,file);
+		return EXIT_FAILURE;
+	}
+
+	planPut(NULL, sizeof(PlanHead), PLAN_ALIGN); //filled in at the end.
+	while((len = getline(&line, &size, input)) >= 0)
+	{
+		lineno++;
+		arenaReset(&arena);
+		bad = parseAll(line, len, &ast, &arena);
+		if(bad > 0)
+		{
+			printf("  %s:%lu: %.*s\n", file, lineno, (int)strcspn(line, "\n"),
+			       line);
+			nbad++;
+		}
+		else if(nbad == 0)
+		{
+			planStore(lineno, line, len, (bad < 0) ? NULL : &ast);
+		}
+	}
+	fclose(input);
+	free(line);
+	if(nbad > 0)
+	{
+		fprintf(stderr,RED "%lu bad lines in %s, no plan written.\n" RESET_COLOR,
+		        nbad,file);
+		return EXIT_FAILURE;
+	}
+	planPut("", 1, 1); //every string of the plan ends before its end.
+	planStamp(&head, &st);
+	head.lines = lineno;
+	memcpy(plan.base, &head, sizeof(head));
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if(fd < 0 || writeAll(fd, plan.base, plan.next) || close(fd) < 0 ||
+	   rename(tmp, path) < 0)
+	{
+		perror(path);
+		unlink(tmp);
+		return EXIT_FAILURE;
+	}
+	printf("%lu lines of %s compiled into %s.\n", lineno, file, path);
+
+	return EXIT_SUCCESS;
+}
+
+/*
+ *******************************************************************************
+ * planStore() appends the PlanLine of one line to the plan that planCompile() *
+ * builds, with its AST copied after it. A NULL ast stores an empty line, so   *
+ * that the plan keeps the line numbers of -j. The pointers of the copy are    *
+ * stored as offsets from the start of the plan, 0 for NULL.                   *
+ *******************************************************************************
+ */
+void planStore(unsigned long lineno, const char *line, size_t len,
+               const Ast *ast)
+{
+	size_t at = planPut(NULL, sizeof(PlanLine), PLAN_ALIGN), off;
+	PlanLine rec;
+	int i;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.lineno = lineno;
+	rec.len = len;
+	rec.text = (char*)planPut(line, len + 1, 1);
+	if(ast != NULL)
+	{
+		rec.ast = *ast;
+		rec.ast.words = (char**)planPut(NULL, ast->nwords * sizeof(char*),
+		                                PLAN_ALIGN);
+		for(i = 0; i < ast->nwords; i++)
+		{
+			off = (ast->words[i] != NULL) ?
+			      planPut(ast->words[i], strlen(ast->words[i]) + 1, 1) : 0;
+			((char**)(plan.base + (size_t)rec.ast.words))[i] = (char*)off;
+		}
+		rec.ast.cmds = (Command*)planPut(ast->cmds,
+		                                 ast->ncmds * sizeof(Command),
+		                                 PLAN_ALIGN);
+		for(i = 0; i < ast->ncmds; i++)
+		{
+			off = (ast->cmds[i].sched != NULL) ?
+			      planPut(ast->cmds[i].sched, sizeof(Sched), PLAN_ALIGN) : 0;
+			((Command*)(plan.base + (size_t)rec.ast.cmds))[i].sched =
+				(Sched*)off;
+		}
+		rec.ast.pipes = (Pipeline*)planPut(ast->pipes,
+		                                   ast->npipes * sizeof(Pipeline),
+		                                   PLAN_ALIGN);
+		for(i = 0; i < ast->npipes; i++)
+		{
+			off = (ast->pipes[i].limits != NULL) ?
+			      planPut(ast->pipes[i].limits, sizeof(Limits), PLAN_ALIGN) : 0;
+			((Pipeline*)(plan.base + (size_t)rec.ast.pipes))[i].limits =
+				(Limits*)off;
+		}
+		if(ast->note != NULL)
+		{
+			rec.ast.note = (char*)planPut(ast->note, strlen(ast->note) + 1, 1);
+		}
+	}
+	rec.next = (plan.next + PLAN_ALIGN - 1) & ~(size_t)(PLAN_ALIGN - 1);
+	memcpy(plan.base + at, &rec, sizeof(rec));
+}
+
+/*
+ *******************************************************************************
+ * planPut() appends len bytes of data, or zeroes when data is NULL, to the    *
+ * plan that planCompile() builds, at the next multiple of align (a power of   *
+ * 2: PLAN_ALIGN for the structures, 1 for the strings), and returns their     *
+ * offset. The buffer doubles when it is full.                                 *
+ *******************************************************************************
+ */
+size_t planPut(const void *data, size_t len, size_t align)
+{
+	size_t at = (plan.next + align - 1) & ~(align - 1);
+
+	if(at + len > plan.size)
+	{
+		plan.size = 2 * plan.size + len + ARENA_BLOCK;
+		plan.base = realloc(plan.base, plan.size);
+		if(plan.base == NULL)
+		{
+			fprintf(stderr,"ERROR: malloc() failure.\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	memset(plan.base + plan.next, 0, at - plan.next);
+	if(data != NULL)
+	{
+		memcpy(plan.base + at, data, len);
+	}
+	else
+	{
+		memset(plan.base + at, 0, len);
+	}
+	plan.next = at + len;
+
+	return at;
+}
+
+/*
+ *******************************************************************************
+ * planStamp() fills the head of a plan for the batchfile with status st: what *
+ * a plan must match to be run instead of the batchfile, that is the file      *
+ * itself, its size and mtime, the layout of the types and the -l limits.      *
+ *******************************************************************************
+ */
+void planStamp(PlanHead *head, const struct stat *st)
+{
+	memset(head, 0, sizeof(*head));
+	memcpy(head->magic, PLAN_MAGIC, sizeof(head->magic));
+	head->sizes[0] = sizeof(PlanLine);
+	head->sizes[1] = sizeof(Command);
+	head->sizes[2] = sizeof(Pipeline);
+	head->sizes[3] = sizeof(Sched);
+	head->sizes[4] = sizeof(Limits);
+	head->dev = st->st_dev;
+	head->ino = st->st_ino;
+	head->size = st->st_size;
+	head->mtime_ns = st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+	head->limits = limits_default;
+}
+
+/*
+ *******************************************************************************
+ * planOpen() looks for the plan of the batchfile. If it exists and the        *
+ * batchfile has not changed since it was compiled, the plan is mapped and     *
+ * checked once, and then every line is run from the mapping with planLine()   *
+ * and planParse() instead of being read and parsed. Otherwise, or if the plan *
+ * is damaged, it is ignored and the lines are read and parsed as usual.       *
+ *******************************************************************************
+ */
+void planOpen(const char *file, FILE *input)
+{
+	char path[PATH_MAX];
+	struct stat st, plan_st;
+	PlanHead stamp, head;
+	void *base;
+	int fd;
+
+	if(snprintf(path, sizeof(path), "%s" PLAN_SUFFIX, file) >= (int)sizeof(path)
+	   || fstat(fileno(input), &st) < 0 ||
+	   (fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+	{
+		return;
+	}
+	if(fstat(fd, &plan_st) < 0 || plan_st.st_size <= (off_t)sizeof(PlanHead))
+	{
+		close(fd);
+		return;
+	}
+	base = mmap(NULL, plan_st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE,
+	            fd, 0);
+	close(fd);
+	if(base == MAP_FAILED)
+	{
+		return;
+	}
+
+	plan.base = base;
+	plan.size = plan_st.st_size;
+	memcpy(&head, plan.base, sizeof(head));
+	plan.lines = head.lines;
+	head.lines = 0;
+	planStamp(&stamp, &st);
+	if(memcmp(&head, &stamp, sizeof(stamp)) || plan.base[plan.size-1] != '\0' ||
+	   planCheck())
+	{
+		munmap(plan.base, plan.size); //out of date: parse the batchfile.
+		plan.base = NULL;
+	}
+}
+
+/*
+ *******************************************************************************
+ * planCheck() checks that every offset of the PlanLines of the mapped plan,   *
+ * and every word index, stays inside the plan, so that planParse() can trust  *
+ * them. It returns 1 when one does not, and then the plan is not used.        *
+ *******************************************************************************
+ */
+int planCheck(void)
+{
+	size_t off = (sizeof(PlanHead) + PLAN_ALIGN - 1) & ~(size_t)(PLAN_ALIGN - 1);
+	const PlanLine *rec;
+	const Command *cmds;
+	const Pipeline *pipes;
+	const Ast *ast;
+	char **words;
+	size_t lines;
+	int bad = 0, i;
+
+	plan.next = off;
+	for(lines = plan.lines; lines > 0; lines--, off = rec->next)
+	{
+		rec = (PlanLine*)planAddr((void*)off, sizeof(PlanLine), PLAN_ALIGN,
+		                          &bad);
+		if(bad || rec->next <= off)
+		{
+			return 1;
+		}
+		ast = &rec->ast;
+		words = (char**)planAddr(ast->words, ast->nwords * sizeof(char*),
+		                         PLAN_ALIGN, &bad);
+		cmds = (Command*)planAddr(ast->cmds, ast->ncmds * sizeof(Command),
+		                          PLAN_ALIGN, &bad);
+		pipes = (Pipeline*)planAddr(ast->pipes, ast->npipes * sizeof(Pipeline),
+		                            PLAN_ALIGN, &bad);
+		planAddr(ast->note, 1, 1, &bad);
+		if(planAddr(rec->text, rec->len, 1, &bad) == NULL || bad ||
+		   (ast->nwords > 0 && words == NULL) ||
+		   (ast->ncmds > 0 && cmds == NULL) ||
+		   (ast->npipes > 0 && pipes == NULL))
+		{
+			return 1;
+		}
+		for(i = 0; i < ast->nwords; i++)
+		{
+			planAddr(words[i], 1, 1, &bad);
+		}
+		for(i = 0; i < ast->ncmds; i++)
+		{
+			planAddr(cmds[i].sched, sizeof(Sched), PLAN_ALIGN, &bad);
+			if(cmds[i].argc < 1 || cmds[i].argv < 0 ||
+			   cmds[i].argv + cmds[i].argc >= ast->nwords ||
+			   words[cmds[i].argv + cmds[i].argc] != NULL ||
+			   cmds[i].in < NO_WORD || cmds[i].in >= ast->nwords ||
+			   cmds[i].out < NO_WORD || cmds[i].out >= ast->nwords)
+			{
+				return 1;
+			}
+		}
+		for(i = 0; i < ast->npipes; i++)
+		{
+			planAddr(pipes[i].limits, sizeof(Limits), PLAN_ALIGN, &bad);
+			if(pipes[i].cmd < 0 || pipes[i].ncmds < 1 ||
+			   pipes[i].cmd + pipes[i].ncmds > ast->ncmds ||
+			   pipes[i].fanout < 0 || pipes[i].fanout >= pipes[i].ncmds)
+			{
+				return 1;
+			}
+		}
+		if(bad)
+		{
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ *******************************************************************************
+ * planAddr() returns the address in the mapped plan of an offset that         *
+ * planStore() kept in a pointer, or NULL for 0. It sets *bad when the len     *
+ * bytes there are not all inside the plan or the offset is not a multiple of  *
+ * align.                                                                      *
+ *******************************************************************************
+ */
+void* planAddr(void *offset, size_t len, size_t align, int *bad)
+{
+	size_t off = (size_t)offset;
+
+	if(off == 0)
+	{
+		return NULL;
+	}
+	if(off % align != 0 || off > plan.size || len > plan.size - off)
+	{
+		*bad = 1;
+		return NULL;
+	}
+	return plan.base + off;
+}
+
+/*
+ *******************************************************************************
+ * planLine() stands for readLine() when the batchfile has a plan: it returns  *
+ * the next line from the mapping, its length in *len and its number in        *
+ * *lineno. At the end of the plan the shell quits as at the end of the        *
+ * batchfile.                                                                  *
+ *******************************************************************************
+ */
+char* planLine(size_t *len, unsigned long *lineno)
+{
+	if(plan.lines == 0)
+	{
+		quitBatch();
+	}
+	plan.line = (PlanLine*)(plan.base + plan.next);
+	plan.next = plan.line->next;
+	plan.lines--;
+	*len = plan.line->len;
+	*lineno = plan.line->lineno;
+
+	return plan.base + (size_t)plan.line->text;
+}
+
+/*
+ *******************************************************************************
+ * planParse() stands for parseAll() when the batchfile has a plan: it fills   *
+ * ast with the AST of the line that planLine() returned last and returns 0,   *
+ * or -1 for an empty line. Only the arrays of words, commands and pipelines   *
+ * are copied to the arena, with their offsets turned into addresses; the      *
+ * strings and the prefixes stay in the mapping.                               *
+ *******************************************************************************
+ */
+int planParse(Ast *ast, Arena *arena)
+{
+	const Ast *rec = &plan.line->ast;
+	char **words = (char**)(plan.base + (size_t)rec->words);
+	int i;
+
+	*ast = *rec;
+	if(rec->npipes == 0)
+	{
+		return -1;
+	}
+	ast->words = (char**)arenaAlloc(arena, rec->nwords * sizeof(char*));
+	ast->cmds = (Command*)arenaAlloc(arena, rec->ncmds * sizeof(Command));
+	ast->pipes = (Pipeline*)arenaAlloc(arena, rec->npipes * sizeof(Pipeline));
+	memcpy(ast->cmds, plan.base + (size_t)rec->cmds,
+	       rec->ncmds * sizeof(Command));
+	memcpy(ast->pipes, plan.base + (size_t)rec->pipes,
+	       rec->npipes * sizeof(Pipeline));
+	for(i = 0; i < rec->nwords; i++)
+	{
+		ast->words[i] = (words[i] != NULL) ?
+		                plan.base + (size_t)words[i] : NULL;
+	}
+	for(i = 0; i < rec->ncmds; i++)
+	{
+		if(ast->cmds[i].sched != NULL)
+		{
+			ast->cmds[i].sched = (Sched*)(plan.base +
+			                              (size_t)ast->cmds[i].sched);
+		}
+	}
+	for(i = 0; i < rec->npipes; i++)
+	{
+		if(ast->pipes[i].limits != NULL)
+		{
+			ast->pipes[i].limits = (Limits*)(plan.base +
+			                                 (size_t)ast->pipes[i].limits);
+		}
+	}
+	if(rec->note != NULL)
+	{
+		ast->note = plan.base + (size_t)rec->note;
+	}
+
+	return 0;
+}
+
+/*
+ *******************************************************************************
+ * batchInit() prepares the parallel batch mode of -j N. Each line gets a slot *
+ * of a ring that is BATCH_WINDOW times larger than N, so that up to N lines   *
+ * run at once while the finished ones wait for the slower lines before them,  *
+ * and with -d the shell can look that far ahead for lines that are ready. The *
+ * shell's own stdout and stderr are kept aside, because they are pointed at   *
+ * the slot of the line that is being parsed.                                  *
+ *******************************************************************************
+ */
+void batchInit(void)
+{
+	int i;
+
+	if(batch.jobs <= 1)
+	{
+		return;
+	}
+
+	batch.nslots = batch.jobs * BATCH_WINDOW;
+	batch.slots = calloc(batch.nslots, sizeof(BatchSlot));
+	if(batch.slots == NULL)
+	{
+		fprintf(stderr,"ERROR: malloc() failure.\n");
+		exit(EXIT_FAILURE);
+	}
+	for(i = 0; i < batch.nslots; i++)
+	{
+		batch.slots[i].pid = -1;
+		batch.slots[i].state = SLOT_FREE;
+	}
+	batch.saved_out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 3);
+	batch.saved_err = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 3);
+}
+
+/*
+ *******************************************************************************
+ * batchLine() queues one line in parallel batch mode. The line is parsed into *
+ * the arena of its slot with stdout and stderr pointed at the slot, so that   *
+ * even its syntax errors come out in order (or taken from the plan). A forked *
+ * worker executes it when a worker is free and, with -d, when the earlier     *
+ * lines it depends on are done, while the shell goes on reading. The output   *
+ * of each line is flushed when all the lines before it are flushed, or as     *
+ * soon as it ends with -t, where every output line gets its batchfile line    *
+ * number as a prefix. A line with 'barrier' or with a builtin that changes    *
+ * the state of the shell (cd, export, ...) waits for every earlier line       *
+ * instead, and then runs inside the shell, so the lines after it see its      *
+ * effect.                                                                     *
+ *******************************************************************************
+ */
+void batchLine(const char *line, size_t len)
+{
+	BatchSlot *slot = batchSlot();
+	int bad;
+
+	if(stats.enabled)
+	{
+		slot->text = (char*)arenaAlloc(&slot->arena, len);
+		slot->len = len;
+		memcpy(slot->text, line, len);
+	}
+
+	batchCapture(slot);
+	if(plan.base != NULL)
+	{
+		bad = planParse(&slot->ast, &slot->arena); //parsed by --compile.
+	}
+	else
+	{
+		bad = parseAll(line, len, &slot->ast, &slot->arena);
+	}
+	if(!bad && batch.dag)
+	{
+		batchDeps(slot);
+	}
+	batchRestore();
+
+	if(bad || batchNeedsShell(&slot->ast))
+	{
+		slot->state = SLOT_DONE;
+		if(!bad)
+		{
+			batchWait(-1);
+			memset(&usage, 0, sizeof(usage));
+			slot->start_us = nowUs();
+			executeAll(&slot->ast);
+			usage.real_us = nowUs() - slot->start_us;
+			if(stats.enabled)
+			{
+				recordLine(slot->lineno, line, len, &usage);
+			}
+		}
+		batchFlush(0);
+		return;
+	}
+
+	slot->state = SLOT_WAITING;
+	batch.pending++;
+	batchStart();
+}
+
+/*
+ *******************************************************************************
+ * batchNeedsShell() tells if a parsed line must run inside the shell in       *
+ * parallel batch mode: it has a 'barrier' or a BUILTIN_SPECIAL builtin.       *
+ *******************************************************************************
+ */
+int batchNeedsShell(Ast *ast)
+{
+	const Builtin *builtin;
+	int i;
+
+	for(i = 0; i < ast->ncmds; i++)
+	{
+		builtin = findBuiltin(ast->words[ast->cmds[i].argv]);
+		if(builtin != NULL && (builtin->flags == BUILTIN_SPECIAL ||
+		                       builtin->fn == builtinBarrier))
+		{
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ *******************************************************************************
+ * batchSlot() returns the slot of the next line, with an empty arena and new  *
+ * memfds for its output. It waits while the ring is full of lines that cannot *
+ * be flushed yet.                                                             *
+ *******************************************************************************
+ */
+BatchSlot* batchSlot(void)
+{
+	BatchSlot *slot;
+
+	while(batch.next - batch.head >= (unsigned long)batch.nslots)
+	{
+		batchWait(1);
+	}
+
+	slot = &batch.slots[batch.next % batch.nslots];
+	slot->lineno = ++batch.next;
+	slot->pid = -1;
+	slot->ndeps = 0;
+	slot->nreads = 0;
+	slot->nwrites = 0;
+	arenaReset(&slot->arena);
+	slot->out_fd = memfd_create("myshell-out", MFD_CLOEXEC);
+	slot->err_fd = memfd_create("myshell-err", MFD_CLOEXEC);
+	if(slot->out_fd < 0 || slot->err_fd < 0)
+	{
+		perror("memfd_create");
+		exit(EXIT_FAILURE);
+	}
+
+	return slot;
+}
+
+/*
+ *******************************************************************************
+ * batchStart() starts the waiting lines that are ready, oldest first, while   *
+ * fewer than N lines are running.                                             *
+ *******************************************************************************
+ */
+void batchStart(void)
+{
+	BatchSlot *slot;
+	unsigned long seq;
+
+	for(seq = batch.head; seq < batch.next && batch.running < batch.jobs;
+	    seq++)
+	{
+		slot = &batch.slots[seq % batch.nslots];
+		if(slot->state == SLOT_WAITING && batchReady(slot))
+		{
+			batchRun(slot);
+		}
+	}
+}
+
+/*
+ *******************************************************************************
+ * batchReady() tells if every line that slot depends on is done. A line older *
+ * than batch.head is already flushed.                                         *
+ *******************************************************************************
+ */
+int batchReady(BatchSlot *slot)
+{
+	BatchSlot *dep;
+	int i;
+
+	for(i = 0; i < slot->ndeps; i++)
+	{
+		if(slot->deps[i] < batch.head)
+		{
+			continue;
+		}
+		dep = &batch.slots[slot->deps[i] % batch.nslots];
+		if(dep->state == SLOT_WAITING || dep->state == SLOT_RUNNING)
+		{
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/*
+ *******************************************************************************
+ * batchRun() forks the worker of a line. The worker writes straight into the  *
+ * memfds of the slot, waits for the '&' jobs of its line and exits with the   *
+ * exit status of the line.                                                    *
+ *******************************************************************************
+ */
+void batchRun(BatchSlot *slot)
+{
+	char label[32];
+	int exit_status;
+
+	batchCapture(slot);
+	slot->start_us = nowUs();
+	slot->pid = fork();
+	if(slot->pid == 0) //Worker: stdout and stderr are already the slot's.
+	{
+		close(sigchld_pipe[0]);
+		close(sigchld_pipe[1]);
+		close(super_fd);
+		setupSignals(); //a self-pipe and a supervisor of its own.
+		superInit();
+		job_table.njobs = 0; //the shell's jobs are not the worker's.
+		if (TRACING)
+		{
+			trace_lanes = 0; //a new process, with lanes of its own.
+			snprintf(label, sizeof(label), "line %lu", slot->lineno);
+			traceName("process_name", 0, label);
+			traceMark("fork", 0, 0);
+		}
+		exit_status = executeAll(&slot->ast);
+		while(job_table.njobs > 0) //a line is done when its jobs are.
+		{
+			waitJob(job_table.jobs[0]);
+			removeJob(job_table.jobs[0]);
+		}
+		fflush(stdout);
+		_exit(exit_status);
+	}
+	else if(slot->pid < 0)
+	{
+		perror("fork");
+		printf("Failed to make child.\n");
+	}
+	batchRestore();
+
+	if(slot->pid < 0)
+	{
+		slot->state = SLOT_DONE;
+		batch.pending--;
+		batchFlush(0);
+		return;
+	}
+	slot->pidfd = superWatch(slot->pid);
+	slot->state = SLOT_RUNNING;
+	batch.running++;
+}
+
+/*
+ *******************************************************************************
+ * batchDeps() finds the earlier lines, still waiting or running, that a line  *
+ * has to wait for under -d: those that write a file it reads or writes, and   *
+ * those that read a file it writes. Lines that share no file run in any       *
+ * order, so in |   echo hi > a ; ls ; cat < a > b ; ps -a (one command per    *
+ * line) only 'cat' waits, for 'echo'.                                         *
+ *******************************************************************************
+ */
+void batchDeps(BatchSlot *slot)
+{
+	unsigned long seq, self = slot->lineno - 1;
+	BatchSlot *earlier;
+
+	batchFiles(slot);
+	slot->deps = (unsigned long*)arenaAlloc(&slot->arena, (self - batch.head + 1)
+	                                        * sizeof(unsigned long));
+	for(seq = batch.head; seq < self; seq++)
+	{
+		earlier = &batch.slots[seq % batch.nslots];
+		if((earlier->state == SLOT_WAITING || earlier->state == SLOT_RUNNING)
+		   && batchConflict(slot, earlier))
+		{
+			slot->deps[slot->ndeps++] = seq;
+		}
+	}
+}
+
+/*
+ *******************************************************************************
+ * batchFiles() collects the files that a line reads and writes. '<' targets   *
+ * are read and '>' targets are written. The line can declare the others with  *
+ * an annotation comment, |   cc -c a.c -o a.o #@ in=a.c,a.h out=a.o and       *
+ * without one every operand that is not an option is taken as a file that may *
+ * be written, and a command given by path as a file that is read. That is     *
+ * safe for 'rm f' or 'cp a b' but may order more than needed.                 *
+ *******************************************************************************
+ */
+void batchFiles(BatchSlot *slot)
+{
+	Ast *ast = &slot->ast;
+	Command *cmd;
+	char *note = NULL, *word, *save, *file, *save_file, **list;
+	int *count, max = ast->nwords, i, k;
+
+	if(ast->note != NULL)
+	{
+		note = (char*)arenaAlloc(&slot->arena, strlen(ast->note) + 1);
+		strcpy(note, ast->note);
+		max += strlen(note);
+	}
+	slot->reads = (char**)arenaAlloc(&slot->arena, max * sizeof(char*));
+	slot->writes = (char**)arenaAlloc(&slot->arena, max * sizeof(char*));
+
+	for(i = 0; i < ast->ncmds; i++)
+	{
+		cmd = &ast->cmds[i];
+		if(cmd->in != NO_WORD)
+		{
+			slot->reads[slot->nreads++] = ast->words[cmd->in];
+		}
+		if(cmd->out != NO_WORD)
+		{
+			slot->writes[slot->nwrites++] = ast->words[cmd->out];
+		}
+		if(note != NULL)
+		{
+			continue; //the annotation replaces the guessing.
+		}
+		if(strchr(ast->words[cmd->argv], '/') != NULL)
+		{
+			slot->reads[slot->nreads++] = ast->words[cmd->argv];
+		}
+		for(k = cmd->argv + 1; ast->words[k] != NULL; k++)
+		{
+			if(ast->words[k][0] != '-')
+			{
+				slot->writes[slot->nwrites++] = ast->words[k];
+			}
+		}
+	}
+
+	for(word = (note != NULL) ? strtok_r(note, SPACE_DELIM, &save) : NULL;
+	    word != NULL; word = strtok_r(NULL, SPACE_DELIM, &save))
+	{
+		if(!strncmp(word, "in=", 3))
+		{
+			list = slot->reads;
+			count = &slot->nreads;
+		}
+		else if(!strncmp(word, "out=", 4))
+		{
+			list = slot->writes;
+			count = &slot->nwrites;
+		}
+		else
+		{
+			printf("ERROR: Bad annotation '%s'. Use in=FILE,... and "
+			       "out=FILE,...\n", word);
+			continue;
+		}
+		for(file = strtok_r(strchr(word, '=') + 1, ",", &save_file);
+		    file != NULL; file = strtok_r(NULL, ",", &save_file))
+		{
+			list[(*count)++] = file;
+		}
+	}
+}
+
+/*
+ *******************************************************************************
+ * batchConflict() tells if the later line must wait for the earlier one.      *
+ *******************************************************************************
+ */
+int batchConflict(BatchSlot *later, BatchSlot *earlier)
+{
+	int i;
+
+	for(i = 0; i < later->nwrites; i++)
+	{
+		if(fileIn(later->writes[i], earlier->reads, earlier->nreads) ||
+		   fileIn(later->writes[i], earlier->writes, earlier->nwrites))
+		{
+			return 1;
+		}
+	}
+	for(i = 0; i < later->nreads; i++)
+	{
+		if(fileIn(later->reads[i], earlier->writes, earlier->nwrites))
+		{
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ *******************************************************************************
+ * fileIn() tells if file is one of files[0..nfiles), comparing them by        *
+ * fileKey().                                                                  *
+ *******************************************************************************
+ */
+int fileIn(const char *file, char **files, int nfiles)
+{
+	const char *key = fileKey(file);
+	int i;
+
+	for(i = 0; i < nfiles; i++)
+	{
+		if(!strcmp(key, fileKey(files[i])))
+		{
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ *******************************************************************************
+ * fileKey() drops the leading './' parts of a path, so './a' and 'a' are the  *
+ * same file for the dependencies.                                             *
+ *******************************************************************************
+ */
+const char* fileKey(const char *file)
+{
+	while(file[0] == '.' && file[1] == '/')
+	{
+		file += 2;
+		while(*file == '/')
+		{
+			file++;
+		}
+	}
+
+	return file;
+}
+
+/*
+ *******************************************************************************
+ * batchCapture() points the shell's stdout and stderr at the slot of a line,  *
+ * batchRestore() points them back.                                            *
+ *******************************************************************************
+ */
+void batchCapture(BatchSlot *slot)
+{
+	fflush(stdout);
+	fflush(stderr);
+	dup2(slot->out_fd, STDOUT_FILENO);
+	dup2(slot->err_fd, STDERR_FILENO);
+}
+
+void batchRestore(void)
+{
+	fflush(stdout);
+	fflush(stderr);
+	dup2(batch.saved_out, STDOUT_FILENO);
+	dup2(batch.saved_err, STDERR_FILENO);
+}
+
+/*
+ *******************************************************************************
+ * batchWait() reaps the workers that have finished, starts the lines that     *
+ * became ready and flushes what can be flushed. With block set it sleeps in   *
+ * the supervisor until at least one worker ends, and with block -1 until      *
+ * every line that was read has ended. The workers are waited for by pid, so   *
+ * the background jobs of the shell keep their statuses.                       *
+ *******************************************************************************
+ */
+void batchWait(int block)
+{
+	struct rusage ru;
+	BatchSlot *slot;
+	Usage line_usage;
+	int i, status, reaped;
+
+	if(batch.slots == NULL)
+	{
+		return;
+	}
+
+	do
+	{
+		reaped = 0;
+		for(i = 0; i < batch.nslots; i++)
+		{
+			slot = &batch.slots[i];
+			if(slot->state == SLOT_RUNNING &&
+			   wait4(slot->pid, &status, WNOHANG, &ru) > 0)
+			{
+				if(stats.enabled) //the worker's usage covers the line.
+				{
+					memset(&line_usage, 0, sizeof(line_usage));
+					addRusage(&line_usage, &ru);
+					line_usage.real_us = nowUs() - slot->start_us;
+					recordLine(slot->lineno, slot->text, slot->len,
+					           &line_usage);
+				}
+				superForget(slot->pidfd);
+				slot->state = SLOT_DONE;
+				batch.running--;
+				batch.pending--;
+				reaped++;
+			}
+		}
+		batchStart();
+		batchFlush(0);
+
+		if(block && batch.running > 0 && (reaped == 0 || block < 0))
+		{
+			superWait(-1);
+		}
+	} while(block && batch.pending > 0 && (reaped == 0 || block < 0));
+
+	if(block < 0)
+	{
+		batchFlush(1);
+	}
+}
+
+/*
+ *******************************************************************************
+ * batchFlush() writes out the output of the finished lines and frees their    *
+ * slots: in line order, or in any order with -t. With all set, every line     *
+ * that has been read must be finished.                                        *
+ *******************************************************************************
+ */
+void batchFlush(int all)
+{
+	BatchSlot *slot;
+	unsigned long seq;
+
+	fflush(stdout);
+	for(seq = batch.head; seq < batch.next; seq++)
+	{
+		slot = &batch.slots[seq % batch.nslots];
+		if(slot->state != SLOT_DONE)
+		{
+			if(!batch.tag && !all)
+			{
+				break; //an earlier line is still running.
+			}
+			continue;
+		}
+
+		copyOutput(slot->out_fd, STDOUT_FILENO, batch.tag ? slot->lineno : 0);
+		copyOutput(slot->err_fd, STDERR_FILENO, batch.tag ? slot->lineno : 0);
+		close(slot->out_fd);
+		close(slot->err_fd);
+		slot->state = SLOT_FREE;
+	}
+
+	while(batch.head < batch.next &&
+	      batch.slots[batch.head % batch.nslots].state == SLOT_FREE)
+	{
+		batch.head++;
+	}
+}
+
+/*
+ *******************************************************************************
+ * copyOutput() writes the whole buffered output in fd to the descriptor to.   *
+ * If lineno is not 0 every line of it starts with 'lineno: '.                 *
+ *******************************************************************************
+ */
+void copyOutput(int fd, int to, unsigned long lineno)
+{
+	static char buf[COPY_BUF];
+	char prefix[32];
+	int line_start = 1, plen = 0;
+	ssize_t n;
+	char *p, *end, *nl;
+
+	if(lineno != 0)
+	{
+		plen = snprintf(prefix, sizeof(prefix), "%lu: ", lineno);
+	}
+
+	lseek(fd, 0, SEEK_SET);
+	while((n = read(fd, buf, sizeof(buf))) > 0)
+	{
+		if(lineno == 0)
+		{
+			writeAll(to, buf, n);
+			continue;
+		}
+		for(p = buf, end = buf + n; p < end; p = nl)
+		{
+			if(line_start)
+			{
+				writeAll(to, prefix, plen);
+			}
+			nl = memchr(p, '\n', end - p);
+			nl = (nl != NULL) ? nl + 1 : end;
+			line_start = (nl[-1] == '\n');
+			writeAll(to, p, nl - p);
+		}
+	}
+}
+
+/*
+ *******************************************************************************
+ * writeAll() writes len bytes of buf to fd, going on after short writes. It   *
+ * returns 0, or -1 on error.                                                  *
+ *******************************************************************************
+ */
+int writeAll(int fd, const char *buf, size_t len)
+{
+	ssize_t n;
+
+	while(len > 0)
+	{
+		n = write(fd, buf, len);
+		if(n < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if(n < 0)
+		{
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/*
+ *******************************************************************************
+ * readAll() reads exactly len bytes of fd into buf, going on after short      *
+ * reads. It returns 0, or 1 on error or when the data ends first.             *
+ *******************************************************************************
+ */
+int readAll(int fd, char *buf, size_t len)
+{
+	ssize_t n;
+
+	while(len > 0)
+	{
+		n = read(fd, buf, len);
+		if(n < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if(n <= 0)
+		{
+			return 1;
+		}
+		buf += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/*
+ *******************************************************************************
+ * serverLoop() is the -L/--listen mode. The shell listens on the Unix socket  *
+ * path and every client that connects gets a session, a process forked from   *
+ * the server. So a request costs one fork() of a warm process instead of the  *
+ * exec and the start of a new shell. Up to -j N sessions run at a time (one   *
+ * per CPU without -j) and more clients wait in the listen queue. The socket   *
+ * is made for the user only, since whoever connects runs commands. It never   *
+ * returns.                                                                    *
+ *******************************************************************************
+ */
+void serverLoop(const char *path)
+{
+	struct sockaddr_un addr;
+	struct stat st;
+	long max = batch.jobs;
+	int listen_fd, fd, sessions = 0;
+	mode_t mask;
+	pid_t pid;
+
+	if(max <= 1)
+	{
+		max = sysconf(_SC_NPROCESSORS_ONLN);
+		max = (max > 1) ? max : 1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if(strlen(path) >= sizeof(addr.sun_path))
+	{
+		fprintf(stderr,RED "Socket path '%s' is too long.\n" RESET_COLOR,path);
+		exit(EXIT_FAILURE);
+	}
+	strcpy(addr.sun_path, path);
+	if(lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+	{
+		unlink(path); //left by a server that is gone.
+	}
+
+	mask = umask(S_IRWXG | S_IRWXO);
+	listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(listen_fd < 0 || bind(listen_fd, (struct sockaddr*)&addr,
+	                         sizeof(addr)) < 0 ||
+	   listen(listen_fd, SOMAXCONN) < 0)
+	{
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	umask(mask);
+	signal(SIGPIPE, SIG_IGN); //a client that hangs up is an EPIPE.
+	printf("Listening on %s\n", path);
+	fflush(stdout);
+
+	while(1)
+	{
+		//Collect the sessions that ended, and wait for one when all are busy.
+		while(sessions > 0 &&
+		      waitpid(-1, NULL, (sessions >= max) ? 0 : WNOHANG) > 0)
+		{
+			sessions--;
+		}
+		fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+		if(fd < 0)
+		{
+			if(errno != EINTR)
+			{
+				perror("accept");
+			}
+			continue;
+		}
+		pid = fork();
+		if(pid == 0) //Child: the session of this client.
+		{
+			close(listen_fd);
+			serveClient(fd);
+			_exit(EXIT_SUCCESS);
+		}
+		else if(pid < 0)
+		{
+			perror("fork");
+		}
+		else
+		{
+			sessions++;
+		}
+		close(fd);
+	}
+}
+
+/*
+ *******************************************************************************
+ * serveClient() runs the requests of one client, one after the other, until   *
+ * it hangs up. Every message is a frame: a type byte, the payload length as 4 *
+ * bytes in network order and then the payload, FRAME_MAX bytes at most. The   *
+ * client sends a script, lines separated by newlines like a batchfile, in     *
+ * FRAME_SCRIPT frames and its last part in a FRAME_RUN frame. The answer is   *
+ * the FRAME_OUT and FRAME_ERR frames of the output while the script runs, and *
+ * then a FRAME_EXIT with the exit status as 4 bytes in network order.         *
+ *******************************************************************************
+ */
+void serveClient(int fd)
+{
+	char head[FRAME_HEAD], exit_frame[FRAME_HEAD + sizeof(uint32_t)];
+	char *script = NULL;
+	size_t len = 0, size = 0;
+	uint32_t n;
+
+	while(readAll(fd, head, FRAME_HEAD) == 0)
+	{
+		memcpy(&n, head + 1, sizeof(n));
+		n = ntohl(n);
+		if(n > FRAME_MAX ||
+		   (head[0] != FRAME_SCRIPT && head[0] != FRAME_RUN))
+		{
+			break; //not a client of this protocol.
+		}
+		if(len + n >= size)
+		{
+			size = 2 * (len + n) + 1;
+			script = realloc(script, size);
+			if(script == NULL)
+			{
+				fprintf(stderr,"ERROR: malloc() failure.\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+		if(readAll(fd, script + len, n))
+		{
+			break;
+		}
+		len += n;
+		if(head[0] == FRAME_RUN)
+		{
+			n = htonl(runRequest(fd, script, len));
+			memcpy(exit_frame + FRAME_HEAD, &n, sizeof(n));
+			if(sendFrame(fd, FRAME_EXIT, exit_frame, sizeof(n)))
+			{
+				break;
+			}
+			len = 0;
+		}
+	}
+	free(script);
+	close(fd);
+}
+
+/*
+ *******************************************************************************
+ * runRequest() runs one script of serveClient() in a forked runner, so a      *
+ * 'cd', an 'export' or a 'quit' stays inside the request. The runner has      *
+ * /dev/null for stdin and pipes for stdout and stderr, and every line goes    *
+ * through parseAll() and executeAll() like a batch line. The session sends    *
+ * what comes out of the pipes to fd while the runner works. When the client   *
+ * hangs up the runner's process group gets SIGTERM. At its end the runner     *
+ * sends its command hash table back (see hashSend()), so the lookups of a     *
+ * request are hits for the next ones. It returns the exit status of the last  *
+ * line that ran.                                                              *
+ *******************************************************************************
+ */
+int runRequest(int fd, const char *script, size_t len)
+{
+	struct pollfd pfds[2];
+	char frame[FRAME_HEAD + FRAME_MAX];
+	const char *line, *next;
+	int out[2], err[2], table[2], status = EXIT_SUCCESS, open_fds = 2, gone = 0;
+	int i;
+	Arena arena = {NULL, NULL};
+	ssize_t n;
+	pid_t pid;
+	Ast ast;
+
+	if(pipe2(out, O_CLOEXEC) < 0)
+	{
+		perror("pipe");
+		return EXIT_FAILURE;
+	}
+	if(pipe2(err, O_CLOEXEC) < 0)
+	{
+		perror("pipe");
+		close(out[0]);
+		close(out[1]);
+		return EXIT_FAILURE;
+	}
+	if(pipe2(table, O_CLOEXEC) < 0)
+	{
+		table[0] = table[1] = -1; //the runner's lookups are just lost.
+	}
+
+	fflush(stdout);
+	pid = fork();
+	if(pid == 0) //Child: the runner, a batch shell with the script as input.
+	{
+		setpgid(0, 0);
+		i = open("/dev/null", O_RDONLY);
+		dup2(i, STDIN_FILENO);
+		dup2(out[1], STDOUT_FILENO);
+		dup2(err[1], STDERR_FILENO);
+		if(table[1] != -1) //fd 3 takes the hash table back to the session.
+		{
+			dup2(table[1], STDERR_FILENO + 1);
+			fcntl(STDERR_FILENO + 1, F_SETFD, FD_CLOEXEC);
+		}
+		closefrom(STDERR_FILENO + 1 + (table[1] != -1));
+		setupSignals();
+		superInit();
+		for(line = script; line < script + len; line = next)
+		{
+			next = memchr(line, '\n', script + len - line);
+			next = (next != NULL) ? next + 1 : script + len;
+			arenaReset(&arena);
+			if(parseAll(line, next - line, &ast, &arena) == 0)
+			{
+				status = executeAll(&ast);
+			}
+		}
+		if(table[1] != -1)
+		{
+			hashSend(STDERR_FILENO + 1);
+		}
+		exit(status); //flushes what the builtins printed.
+	}
+	close(out[1]);
+	close(err[1]);
+	if(table[1] != -1)
+	{
+		close(table[1]);
+	}
+	if(pid < 0)
+	{
+		perror("fork");
+		close(out[0]);
+		close(err[0]);
+		if(table[0] != -1)
+		{
+			close(table[0]);
+		}
+		return EXIT_FAILURE;
+	}
+
+	pfds[0].fd = out[0];
+	pfds[1].fd = err[0];
+	pfds[0].events = pfds[1].events = POLLIN;
+	while(open_fds > 0)
+	{
+		if(poll(pfds, 2, -1) < 0)
+		{
+			continue; //EINTR
+		}
+		for(i = 0; i < 2; i++)
+		{
+			if(pfds[i].fd < 0 || pfds[i].revents == 0)
+			{
+				continue;
+			}
+			n = read(pfds[i].fd, frame + FRAME_HEAD, FRAME_MAX);
+			if(n < 0 && errno == EINTR)
+			{
+				continue;
+			}
+			if(n <= 0)
+			{
+				close(pfds[i].fd);
+				pfds[i].fd = -1; //poll() skips it now.
+				open_fds--;
+			}
+			else if(!gone && sendFrame(fd, (i == 0) ? FRAME_OUT : FRAME_ERR,
+			                           frame, n))
+			{
+				gone = 1; //the rest of the output is dropped.
+				kill(-pid, SIGTERM);
+			}
+		}
+	}
+	while(waitpid(pid, &status, 0) < 0 && errno == EINTR);
+	if(table[0] != -1)
+	{
+		hashRecv(table[0]); //the commands it found, for the next request.
+		close(table[0]);
+	}
+
+	return exitStatus(status);
+}
+
+/*
+ *******************************************************************************
+ * sendFrame() sends a frame of the given type to fd. frame has FRAME_HEAD     *
+ * free bytes for the header and then the len bytes of the payload, so the     *
+ * whole frame goes out in one write. It returns 0, or -1 on error.            *
+ *******************************************************************************
+ */
+int sendFrame(int fd, char type, char *frame, size_t len)
+{
+	uint32_t n = htonl((uint32_t)len);
+
+	frame[0] = type;
+	memcpy(frame + 1, &n, sizeof(n));
+
+	return writeAll(fd, frame, FRAME_HEAD + len);
+}
+
+/*
+ *******************************************************************************
+ * parseLine() function reads an input line and "cuts" it into several pieces  *
+ * of arguments in order to save the several arguments in the commands. Words  *
+ * are separated by SPACE_DELIM characters and by the operator characters      *
+ * ;&|<> which need no spaces around them, so 'ls|wc' is 3 tokens. A run of    *
+ * the same operator character is one token (';', '&&', ';;', ...), and        *
+ * checkArgs() decides if it is valid. Single quotes keep everything literally *
+ * and double quotes keep everything except \" and \\. Outside quotes a        *
+ * backslash makes the next character literal. A quoted '|' is a plain word    *
+ * and not an operator. After '|&' the '{', ',' and '}' of its branch list are *
+ * operators too, so they end words there. A '#' at the start of a word        *
+ * comments out the rest of the line; the text of a '#@' annotation comment is *
+ * kept as the text of the TOK_END token. The tokens and their text live in    *
+ * the per-line arena and the array ends with a TOK_END token. It returns NULL *
+ * for an unterminated quote.                                                  *
+ *******************************************************************************
+ */
+Token* parseLine(const char *line, size_t len, Arena *arena)
+{
+	char *text = (char*)arenaAlloc(arena, 2 * len + 2); //text plus the NULs.
+	Token *tokens = (Token*)arenaAlloc(arena, TOKENS_INIT * sizeof(Token));
+	Token *grown;
+	const char *quote;
+	char *note = NULL;
+	size_t token_num = 0, capacity = TOKENS_INIT, i = 0, j, k;
+	int braces = 0; //1 after '|&', 2 inside its '{...}'.
+	char c;
+
+	while(1)
+	{
+		while(i < len && char_class[(unsigned char)line[i]] == CHAR_SPACE)
+		{
+			i++;
+		}
+		if(token_num + 1 == capacity) //keep room for the TOK_END token.
+		{
+			grown = (Token*)arenaAlloc(arena, 2 * capacity * sizeof(Token));
+			memcpy(grown, tokens, token_num * sizeof(Token));
+			tokens = grown;
+			capacity *= 2;
+		}
+		if(i == len)
+		{
+			break;
+		}
+		if(line[i] == '#') //a comment, '#@' is an annotation for -d.
+		{
+			if(i + 1 < len && line[i+1] == '@')
+			{
+				note = text;
+				memcpy(text, line + i + 2, len - i - 2);
+				text += len - i - 2;
+				*text++ = '\0';
+			}
+			break;
+		}
+
+		tokens[token_num].text = text;
+		if((braces == 1 && line[i] == '{') ||
+		   (braces == 2 && (line[i] == ',' || line[i] == '}')))
+		{
+			braces = (line[i] == '}') ? 0 : 2;
+			*text++ = line[i++];
+			*text++ = '\0';
+			tokens[token_num++].type = TOK_OP;
+			continue;
+		}
+		if(char_class[(unsigned char)line[i]] == CHAR_OP)
+		{
+			c = line[i];
+			do
+			{
+				*text++ = line[i++];
+			} while(i < len && line[i] == c);
+			if(c == '|' && text == tokens[token_num].text + 1 && i < len &&
+			   line[i] == '&')
+			{
+				*text++ = line[i++]; //'|&' starts a fan-out.
+				braces = 1;
+			}
+			*text++ = '\0';
+			tokens[token_num++].type = TOK_OP;
+			continue;
+		}
+
+		while(i < len) //a word, possibly made of several quoted parts.
+		{
+			k = scanSpecial(line + i, len - i);
+			for(j = 0; braces == 2 && j < k; j++) //',' and '}' end it in {...}.
+			{
+				if(line[i+j] == ',' || line[i+j] == '}')
+				{
+					k = j;
+				}
+			}
+			memcpy(text, line + i, k);
+			text += k;
+			i += k;
+			if(i == len || char_class[(unsigned char)line[i]] != CHAR_QUOTE)
+			{
+				break; //white space or operator: the word is over.
+			}
+
+			c = line[i++];
+			if(c == '\'')
+			{
+				quote = (const char*)memchr(line + i, '\'', len - i);
+				if(quote == NULL)
+				{
+					printf("ERROR: Bad syntax. Unterminated ' quote.\n");
+					return NULL;
+				}
+				memcpy(text, line + i, quote - (line + i));
+				text += quote - (line + i);
+				i = quote - line + 1;
+			}
+			else if(c == '"')
+			{
+				while(i < len && line[i] != '"')
+				{
+					if(line[i] == '\\' && i + 1 < len &&
+					   (line[i+1] == '"' || line[i+1] == '\\'))
+					{
+						i++;
+					}
+					*text++ = line[i++];
+				}
+				if(i == len)
+				{
+					printf("ERROR: Bad syntax. Unterminated \" quote.\n");
+					return NULL;
+				}
+				i++;
+			}
+			else if(i < len) // '\' outside quotes
+			{
+				*text++ = line[i++];
+			}
+		}
+		*text++ = '\0';
+		tokens[token_num++].type = TOK_WORD;
+	}
+	tokens[token_num].text = note;
+	tokens[token_num].type = TOK_END;
+
+	return tokens;
+}
+
+/*
+ *******************************************************************************
+ * scanSpecial() returns the index of the first byte of p[0..n) that ends a    *
+ * plain word (white space, operator character, quote or backslash), or n if   *
+ * there is none. With SSE2 it tests 16 bytes per step: each special byte is   *
+ * compared against the whole vector and the first match comes from the        *
+ * movemask. The tail and other CPUs use the char_class table.                 *
+ *******************************************************************************
+ */
+size_t scanSpecial(const char *p, size_t n)
+{
+	size_t i = 0;
+#ifdef __SSE2__
+	static const char specials[] = SPACE_DELIM OPERATOR_CHARS "\"'\\";
+	__m128i chunk, hits;
+	unsigned int j, mask;
+
+	for(; i + 16 <= n; i += 16)
+	{
+		chunk = _mm_loadu_si128((const __m128i*)(p + i));
+		hits = _mm_setzero_si128();
+		for(j = 0; j < sizeof(specials) - 1; j++)
+		{
+			hits = _mm_or_si128(hits,
+			       _mm_cmpeq_epi8(chunk, _mm_set1_epi8(specials[j])));
+		}
+		mask = (unsigned int)_mm_movemask_epi8(hits);
+		if(mask != 0)
+		{
+			return i + __builtin_ctz(mask);
+		}
+	}
+#endif
+	for(; i < n; i++)
+	{
+		if(char_class[(unsigned char)p[i]] != 0)
+		{
+			return i;
+		}
+	}
+	return n;
+}
+
+/*
+ *******************************************************************************
+ * checkArgs() is a function which checks for possible syntax errors in the    *
+ * arguments provided by the user.                                             *
+ *******************************************************************************
+ */
+int checkArgs(Token *args)
+{
+	int check_status = 0, i = 0;
+	if(args[0].type == TOK_OP)
+	{
+		printf("ERROR: Bad syntax. Unexpected first character.\n");
+		check_status = 1;
+		return check_status;
+	}
+	while(args[i].type != TOK_END)
+	{	
+		if(args[i].type == TOK_WORD)
+		{
+			i++;
+			continue;
+		}
+		if(strstr(args[i].text, ";;") != NULL)
+		{	
+			printf("ERROR: Bad syntax. Two or more ';' found sequentially\n");
+			check_status = 1;
+			return check_status;
+		}
+		else if(strstr(args[i].text, "&&&") != NULL)
+		{
+			printf("ERROR: Bad syntax. Three or more '&' found sequentially\n");
+			check_status = 1;
+			return check_status;
+		}
+		else if(!isOp(&args[i], ";") && !isOp(&args[i], "&&") &&
+		        !isOp(&args[i], "&") && !isOp(&args[i], "|") &&
+		        !isOp(&args[i], "<") && !isOp(&args[i], ">") &&
+		        !isOp(&args[i], "|&") && !isOp(&args[i], "{") &&
+		        !isOp(&args[i], ",") && !isOp(&args[i], "}"))
+		{
+			printf("ERROR: Bad syntax. Unexpected token %s.\n", args[i].text);
+			check_status = 1;
+			return check_status;
+		}
+		else if (i > 0)
+		{
+			if((isOp(&args[i], ";") || isOp(&args[i], "&&") ||
+			    isOp(&args[i], "&")) &&
+			   (isOp(&args[i-1], ";") || isOp(&args[i-1], "&&") ||
+			    isOp(&args[i-1], "&")))
+			{
+				printf("ERROR: Bad syntax. Unexpected token after ;, && or &.\n");
+				check_status = 1;
+				return check_status;			
+			}
+		}
+		i++;
+	}
+	if(args[i-1].type == TOK_OP && !isOp(&args[i-1], "&") &&
+	   !isOp(&args[i-1], "}"))
+	{
+		printf("ERROR: Bad syntax. Unexpected last token.\n");
+		check_status = 1;
+		return check_status;
+	}
+
+	return check_status;
+}
+
+/*
+ *******************************************************************************
+ * parseArgs() is a function which turns the tokens of a line into a flat AST  *
+ * in one pass. The line is a list of pipelines separated by ';', '&&' or '&', *
+ * each pipeline is a list of commands separated by '|', possibly ending in a  *
+ * fan-out '|& {a, b}' whose branches are counted in pipeline->fanout, and     *
+ * every command may have one '<' and one '>' target anywhere among its words. *
+ * For example                                                                 *
+ *   ``` a < x | b > y && c & d ```                                            *
+ * gives 3 pipelines: {a < x, b > y} with OP_AND, {c} with OP_SEQ and {d} with *
+ * OP_END. The '&' marks the and-or list that it ends (here both of the first  *
+ * pipelines) as a background job. A pipeline may start with the prefixes      *
+ * 'time', 'timeout SECS', 'pipesize SIZE' and 'limit SPEC... --', which are   *
+ * kept in the Pipeline and not in the words, and every command may start with *
+ * 'sched SPEC... --', which is kept in the Command. Every node refers to the  *
+ * others by index, and the argv of every command is a NULL ended run of       *
+ * ast->words, so it can be handed to exec as it is. The arrays come from the  *
+ * per-line arena. It returns 0 on success and 1 (after printing the error) on *
+ * bad syntax.                                                                 *
+ *******************************************************************************
+ */
+int parseArgs(Token *args, Ast *ast, Arena *arena)
+{
+	char *in_file = NULL, *out_file = NULL;
+	Pipeline *pipeline;
+	Command *cmd;
+	long long timeout;
+	char *rest;
+	int ntokens = 0, i = 0, bg, end, braces = 0;
+
+	while(args[ntokens].type != TOK_END)
+	{
+		ntokens++;
+	}
+
+	//Every command adds at most 3 words (NULL, '<', '>') to its tokens.
+	ast->words = (char**)arenaAlloc(arena, (2 * ntokens + 3) * sizeof(char*));
+	ast->cmds = (Command*)arenaAlloc(arena, (ntokens + 1) * sizeof(Command));
+	ast->pipes = (Pipeline*)arenaAlloc(arena, (ntokens + 1) * sizeof(Pipeline));
+	ast->nwords = 0;
+	ast->ncmds = 0;
+	ast->npipes = 0;
+	ast->note = args[ntokens].text;
+
+	pipeline = &ast->pipes[ast->npipes++];
+	pipeline->cmd = 0;
+	pipeline->ncmds = 0;
+	pipeline->op = OP_END;
+	pipeline->bg = 0;
+	pipeline->timed = 0;
+	pipeline->memo = 0;
+	pipeline->timeout_us = 0;
+	pipeline->limits = NULL;
+	pipeline->pipe_size = 0;
+	pipeline->fanout = 0;
+	ast->cmds[0].argv = 0;
+	ast->cmds[0].argc = 0;
+	ast->cmds[0].sched = NULL;
+
+	for(i = 0; i < ntokens; i++)
+	{
+		if(pipeline->fanout > 0 && braces == 0 && !isOp(&args[i], ";") &&
+		   !isOp(&args[i], "&&") && !isOp(&args[i], "&"))
+		{
+			printf("ERROR: Bad syntax. Unexpected %s after '}'.\n", args[i].text);
+			return 1;
+		}
+		else if(braces && (isOp(&args[i], "|") || isOp(&args[i], ";") ||
+		        isOp(&args[i], "&&") || isOp(&args[i], "&") ||
+		        isOp(&args[i], "|&")))
+		{
+			printf("ERROR: Bad syntax. Unexpected %s inside '{...}'.\n",
+			       args[i].text);
+			return 1;
+		}
+		else if(isOp(&args[i], "|&") || isOp(&args[i], ",") ||
+		        isOp(&args[i], "}"))
+		{
+			if(args[i].text[0] == '|' && !isOp(&args[i+1], "{"))
+			{
+				printf("ERROR: Bad syntax. Missing '{' after |&.\n");
+				return 1;
+			}
+			if(endCommand(ast, in_file, out_file))
+			{
+				return 1;
+			}
+			in_file = NULL;
+			out_file = NULL;
+			pipeline->ncmds++;
+			if(args[i].text[0] == '|')
+			{
+				braces = 1; //the branches of the fan-out follow.
+				i++;
+			}
+			else
+			{
+				pipeline->fanout++;
+				braces = isOp(&args[i], ",");
+			}
+		}
+		else if(isOp(&args[i], "<") || isOp(&args[i], ">"))
+		{
+			if(args[i+1].type != TOK_WORD)
+			{
+				printf("ERROR: Bad syntax. Missing file after %s.\n",
+				       args[i].text);
+				return 1;
+			}
+			if(args[i].text[0] == '<')
+			{
+				in_file = args[++i].text;
+			}
+			else
+			{
+				out_file = args[++i].text;
+			}
+		}
+		else if(isOp(&args[i], "|") || isOp(&args[i], ";") ||
+		        isOp(&args[i], "&&") || isOp(&args[i], "&"))
+		{
+			if(pipeline->fanout == 0) //a '}' has already ended the command.
+			{
+				if(endCommand(ast, in_file, out_file))
+				{
+					return 1;
+				}
+				in_file = NULL;
+				out_file = NULL;
+				pipeline->ncmds++;
+			}
+			if(isOp(&args[i], "&"))
+			{
+				//the whole and-or list that '&' ends goes to the background.
+				for(bg = ast->npipes - 1; bg >= 0; bg--)
+				{
+					ast->pipes[bg].bg = 1;
+					if(bg > 0 && ast->pipes[bg-1].op != OP_AND)
+					{
+						break;
+					}
+				}
+			}
+			//';', '&&' and '&' start a new pipeline, unless they end the line.
+			if(args[i].text[0] != '|' && args[i+1].type != TOK_END)
+			{
+				pipeline->op = isOp(&args[i], "&&") ? OP_AND : OP_SEQ;
+				pipeline = &ast->pipes[ast->npipes++];
+				pipeline->cmd = ast->ncmds;
+				pipeline->ncmds = 0;
+				pipeline->op = OP_END;
+				pipeline->bg = 0;
+				pipeline->timed = 0;
+				pipeline->memo = 0;
+				pipeline->timeout_us = 0;
+				pipeline->limits = NULL;
+				pipeline->pipe_size = 0;
+				pipeline->fanout = 0;
+			}
+		}
+		else if(ast->ncmds == pipeline->cmd && !pipeline->timed &&
+		        ast->cmds[ast->ncmds].argc == 0 &&
+		        !strcmp(args[i].text, "time") && args[i+1].type == TOK_WORD)
+		{
+			pipeline->timed = 1; //'time' is a prefix of the whole pipeline.
+		}
+		else if(ast->ncmds == pipeline->cmd && !pipeline->memo &&
+		        ast->cmds[ast->ncmds].argc == 0 &&
+		        !strcmp(args[i].text, "memo") && args[i+1].type == TOK_WORD)
+		{
+			pipeline->memo = 1; //so is 'memo'.
+		}
+		else if(ast->ncmds == pipeline->cmd && pipeline->timeout_us == 0 &&
+		        ast->cmds[ast->ncmds].argc == 0 &&
+		        !strcmp(args[i].text, "timeout") && args[i+1].type == TOK_WORD &&
+		        args[i+2].type == TOK_WORD &&
+		        (timeout = parseSeconds(args[i+1].text)) >= 0)
+		{
+			pipeline->timeout_us = timeout; //and so is 'timeout SECS'.
+			i++;
+		}
+		else if(ast->ncmds == pipeline->cmd && pipeline->pipe_size == 0 &&
+		        ast->cmds[ast->ncmds].argc == 0 &&
+		        !strcmp(args[i].text, "pipesize") && args[i+1].type == TOK_WORD &&
+		        args[i+2].type == TOK_WORD &&
+		        (timeout = parseSize(args[i+1].text, &rest)) > 0 &&
+		        *rest == '\0' && timeout <= INT_MAX)
+		{
+			pipeline->pipe_size = (long)timeout; //'pipesize SIZE' as well.
+			i++;
+		}
+		else if(ast->ncmds == pipeline->cmd && pipeline->limits == NULL &&
+		        ast->cmds[ast->ncmds].argc == 0 &&
+		        !strcmp(args[i].text, "limit") && (end = prefixEnd(args, i)) > 0)
+		{
+			pipeline->limits = (Limits*)arenaAlloc(arena, sizeof(Limits));
+			*pipeline->limits = limits_default; //what it does not set, -l does.
+			for(i++; i < end; i++)
+			{
+				if(parseLimits(pipeline->limits, args[i].text))
+				{
+					printf("ERROR: Bad syntax. Bad limit '%s'.\n", args[i].text);
+					return 1;
+				}
+			}
+		}
+		else if(ast->cmds[ast->ncmds].argc == 0 &&
+		        ast->cmds[ast->ncmds].sched == NULL &&
+		        !strcmp(args[i].text, "sched") && (end = prefixEnd(args, i)) > 0)
+		{
+			cmd = &ast->cmds[ast->ncmds]; //'sched' is a prefix of one stage.
+			cmd->sched = (Sched*)arenaAlloc(arena, sizeof(Sched));
+			CPU_ZERO(&cmd->sched->cpus);
+			cmd->sched->nice = NO_NICE;
+			cmd->sched->policy = -1;
+			cmd->sched->ioprio = -1;
+			for(i++; i < end; i++)
+			{
+				if(parseSched(cmd->sched, args[i].text))
+				{
+					printf("ERROR: Bad syntax. Bad sched '%s'.\n", args[i].text);
+					return 1;
+				}
+			}
+		}
+		else
+		{
+			ast->words[ast->nwords++] = args[i].text;
+			ast->cmds[ast->ncmds].argc++;
+		}
+	}
+	if(braces)
+	{
+		printf("ERROR: Bad syntax. Missing '}'.\n");
+		return 1;
+	}
+	if(ntokens > 0 && !isOp(&args[ntokens-1], ";") &&
+	   !isOp(&args[ntokens-1], "&&") && !isOp(&args[ntokens-1], "&") &&
+	   !isOp(&args[ntokens-1], "}")) //a trailing ';', '&' or '}' ended it.
+	{
+		if(endCommand(ast, in_file, out_file))
+		{
+			return 1;
+		}
+		pipeline->ncmds++;
+	}
+
+	return 0;
+}
+
+/*
+ *******************************************************************************
+ * endCommand() closes the command that parseArgs() is filling: its argv gets  *
+ * the NULL terminator, the redirect targets are stored after it and the next  *
+ * command is started. It returns 1 for an empty command, like in 'ls | | wc'. *
+ *******************************************************************************
+ */
+int endCommand(Ast *ast, char *in_file, char *out_file)
+{
+	Command *cmd = &ast->cmds[ast->ncmds];
+
+	if(cmd->argc == 0)
+	{
+		printf("ERROR: Bad syntax. Empty command.\n");
+		return 1;
+	}
+	ast->words[ast->nwords++] = NULL;
+	cmd->in = NO_WORD;
+	cmd->out = NO_WORD;
+	if(in_file != NULL)
+	{
+		cmd->in = ast->nwords;
+		ast->words[ast->nwords++] = in_file;
+	}
+	if(out_file != NULL)
+	{
+		cmd->out = ast->nwords;
+		ast->words[ast->nwords++] = out_file;
+	}
+
+	cmd = &ast->cmds[++ast->ncmds];
+	cmd->argv = ast->nwords;
+	cmd->argc = 0;
+	cmd->sched = NULL;
+
+	return 0;
+}
+
+/*
+ *******************************************************************************
+ * arenaAlloc() returns size bytes from the per-line arena. Memory is handed   *
+ * out by bumping a pointer and is never freed one allocation at a time: the   *
+ * whole arena is recycled by arenaReset() once the line has been executed. A  *
+ * new block is malloc()'ed only when no kept block is big enough, so after    *
+ * the first few lines the main loop does not call malloc() at all.            *
+ *******************************************************************************
+ */
+void* arenaAlloc(Arena *arena, size_t size)
+{
+	ArenaBlock *block = arena->current;
+	size_t block_size;
+	void *ptr;
+
+	size = (size + 15) & ~(size_t)15; //keep every allocation 16 byte aligned.
+
+	while(block != NULL && block->used + size > block->size)
+	{
+		block = block->next; //blocks after current are empty since the reset.
+	}
+	if(block == NULL)
+	{
+		block_size = (size > ARENA_BLOCK) ? size : ARENA_BLOCK;
+		block = (ArenaBlock*)malloc(sizeof(ArenaBlock) + block_size);
+		if(block == NULL)
+		{
+			fprintf(stderr, "ERROR: malloc() failure.\n");
+			exit(EXIT_FAILURE);
+		}
+		block->size = block_size;
+		block->used = 0;
+		if(arena->current == NULL)
+		{
+			block->next = NULL;
+			arena->head = block;
+		}
+		else
+		{
+			block->next = arena->current->next;
+			arena->current->next = block;
+		}
+	}
+
+	arena->current = block;
+	ptr = block->data + block->used;
+	block->used += size;
+
+	return ptr;
+}
+
+/*
+ *******************************************************************************
+ * arenaReset() makes the whole arena free again. The blocks stay allocated    *
+ * and are reused in the same order, so memory stays at the size that the      *
+ * biggest line has needed.                                                    *
+ *******************************************************************************
+ */
+void arenaReset(Arena *arena)
+{
+	ArenaBlock *block;
+
+	for(block = arena->head; block != NULL; block = block->next)
+	{
+		block->used = 0;
+	}
+	arena->current = arena->head;
+}
+
+/*
+ *******************************************************************************
+ * isOp() checks whether a token is the operator op (a quoted one is a word).  *
+ *******************************************************************************
+ */
+int isOp(const Token *token, const char *op)
+{
+	return token->type == TOK_OP && !strcmp(token->text, op);
+}
+
+/*
+ *******************************************************************************
+ * executeAll() is the main execute function. It walks the line one and-or     *
+ * list at a time, which is a run of pipelines joined with '&&'. A list that   *
+ * ends with '&' is started as a background job and the shell goes on at once, *
+ * any other list runs in the foreground. With -w the line gets its deadline   *
+ * here. It returns the exit status of the last list.                          *
+ *******************************************************************************
+ */
+int executeAll(Ast *ast)
+{
+	int exit_status = 0, first = 0, last;
+
+	line_deadline = (line_timeout > 0) ? nowUs() + line_timeout : 0;
+
+	while(first < ast->npipes)
+	{
+		last = first;
+		while(ast->pipes[last].op == OP_AND)
+		{
+			last++;
+		}
+
+		if(ast->pipes[first].bg)
+		{
+			exit_status = executeBackground(ast, first, last);
+		}
+		else
+		{
+			exit_status = executeList(ast, first, last);
+		}
+		first = last + 1;
+	}
+
+	return exit_status;
+}
+
+/*
+ *******************************************************************************
+ * executeList() runs the pipelines first..last of an and-or list in the       *
+ * foreground. After '&&' a pipeline only runs when the previous one exited    *
+ * with 0, so 'false && a && b' runs only false. It returns the exit status of *
+ * the last pipeline that ran.                                                 *
+ *******************************************************************************
+ */
+int executeList(Ast *ast, int first, int last)
+{
+	int exit_status = 0, i;
+
+	for(i = first; i <= last && exit_status == 0; i++)
+	{
+		if(ast->pipes[i].timed)
+		{
+			exit_status = timePipe(ast, &ast->pipes[i]);
+		}
+		else if(ast->pipes[i].memo)
+		{
+			exit_status = memoPipe(ast, &ast->pipes[i]);
+		}
+		else
+		{
+			exit_status = executePipe(ast, &ast->pipes[i], NULL);
+		}
+	}
+
+	return exit_status;
+}
+
+/*
+ *******************************************************************************
+ * executeBackground() starts the and-or list first..last as a background job  *
+ * with a process group of its own and adds it to the job table. A single      *
+ * pipeline is started directly. A longer list needs its '&&' decisions taken  *
+ * while the shell goes on, a 'timeout' needs someone to watch the clock a     *
+ * 'limit' a cgroup that is removed at the end, a 'memo' the copying of its    *
+ * output and a fan-out its fanPipe() process that is not a stage, so they run *
+ * in a forked subshell. It returns 0 once the job is started.                 *
+ *******************************************************************************
+ */
+int executeBackground(Ast *ast, int first, int last)
+{
+	Pipeline *pipeline = &ast->pipes[first];
+	pid_t pids[pipeline->ncmds];
+	int npids = 0, i;
+
+	if(first == last && pipeline->timeout_us == 0 && !pipeline->memo &&
+	   pipeLimits(pipeline) == NULL && pipeline->fanout == 0)
+	{
+		executePipe(ast, pipeline, pids);
+		for(i = 0; i < pipeline->ncmds; i++) //keep the stages that started.
+		{
+			if(pids[i] > 0)
+			{
+				pids[npids++] = pids[i];
+			}
+		}
+	}
+	else
+	{
+		fflush(stdout);
+		pids[0] = fork();
+		if(pids[0] < 0)
+		{
+			perror("fork");
+			printf("Failed to make child.\n");
+		}
+		else if(pids[0] == 0) //Child: the subshell that runs the list.
+		{
+			setpgid(0, 0);
+			resetSignals();
+			close(sigchld_pipe[0]);
+			close(sigchld_pipe[1]);
+			close(super_fd);
+			interactive = 0;
+			line_deadline = 0; //the job is not bound by the line's -w limit.
+			setupSignals(); //the subshell supervises its own children.
+			superInit();
+			_exit(executeList(ast, first, last));
+		}
+		else
+		{
+			setpgid(pids[0], pids[0]); //also here, whoever runs first.
+			npids = 1;
+		}
+	}
+
+	if(npids == 0)
+	{
+		return EXIT_FAILURE;
+	}
+	addJob(pids, npids, jobText(ast, first, last));
+
+	return EXIT_SUCCESS;
+}
+
+/*
+ *******************************************************************************
+ * executeCmd() is a function which executes a single command of the AST       *
+ * together with its '<' and '>' redirections in the foreground. Builtins run  *
+ * inside the shell, everything else in a child which is waited for. The       *
+ * return value is the exit status of the command.                             *
+ *******************************************************************************
+ */
+int executeCmd(Ast *ast, Command *cmd)
+{
+	const Builtin *builtin = findBuiltin(ast->words[cmd->argv]);
+	Launch launch;
+	pid_t pid;
+	int status;
+
+	setLaunch(&launch, ast, cmd);
+	if(builtin != NULL)
+	{
+		return runBuiltin(builtin, &launch);
+	}
+
+	pid = launchCmd(&launch);
+	if(pid < 0)
+	{
+		return EXIT_FAILURE;
+	}
+
+	status = -1;
+	superReap(&pid, 1, &status, NULL, 0);
+	if(TRACING)
+	{
+		traceEvent(launch.argv[0], launch.lane, launch.start_us, nowUs(), pid);
+		traceMark("wait", 0, 0);
+	}
+
+	return exitStatus(status); 
+}
+
+/*
+ *******************************************************************************
+ * executePipe() is a function which is responsible for pipeline commands. A   *
+ * single foreground command is left to executeCmd(), unless a deadline,       *
+ * limits or a 'sched' bound a builtin that does not change the shell.         *
+ * Otherwise every pipe is created and every stage is started up front so that *
+ * they all run concurrently, and only after that the supervisor reaps them in *
+ * the order they end. One builtin stage may run inside the shell, after all   *
+ * the other stages are started. The return value is the exit status of the    *
+ * last stage. A pipeline with a deadline (see pipeDeadline()) runs every      *
+ * stage as a child in a process group of its own, and when the deadline       *
+ * passes killPipe() ends the group and the status is TIMEOUT_STATUS. With     *
+ * limits (see pipeLimits()) every stage is a child as well, started with      *
+ * fork() so that applyLimits() runs before the exec, and the pipeline gets a  *
+ * cgroup of its own when there is one to be had. Pipes get the capacity of a  *
+ * 'pipesize' prefix or of -B, and with -R each pipe of a foreground pipeline  *
+ * goes through a relayPipe() that measures it. In a fan-out the output of the *
+ * last stage before '|&' goes to fanPipe(), which copies it to a pipe per     *
+ * branch, and the status is that of the last branch. When bg_pids is not NULL *
+ * the pipeline is a background job: every stage is forked into one new        *
+ * process group, the pids (-1 for a stage that failed) are stored in bg_pids  *
+ * and nothing is waited for.                                                  *
+ *******************************************************************************
+ */
+int executePipe(Ast *ast, Pipeline *pipeline, pid_t *bg_pids)
+{
+	const Builtin *builtin, *inner = NULL; /* inner: builtin run in the shell */
+	Launch launch, inner_launch;
+	pid_t pids[pipeline->ncmds], pgid = 0;
+	pid_t relays[pipeline->ncmds]; //-R: relay of the pipe after each stage.
+	int relay_statuses[pipeline->ncmds];
+	int branches[pipeline->ncmds]; //pipes that fanPipe() feeds the branches.
+	int fan = pipeline->ncmds - pipeline->fanout, fan_status = -1;
+	pid_t fan_pid = -1;
+	long long started[pipeline->ncmds]; //traced: when each stage started.
+	long long ended[pipeline->ncmds];
+	int statuses[pipeline->ncmds];
+	int status = 0, exit_status = EXIT_FAILURE, fd[2] = {-1, -1}, prev_fd = -1;
+	int stages = pipeline->ncmds, i = 0, inner_idx = -1, timed_out;
+	long long deadline = (bg_pids == NULL) ? pipeDeadline(pipeline) : 0;
+	const Limits *limits = pipeLimits(pipeline);
+	char cg_dir[PATH_MAX];
+	int cg_fd = -1, pin = -1;
+	long size = (pipeline->pipe_size > 0) ? pipeline->pipe_size : pipe_size;
+	int relay = pipe_stats && bg_pids == NULL;
+
+	//A command alone is left to executeCmd() unless it is bounded. Then only
+	//a builtin that changes the shell, like 'cd', still runs in the shell:
+	//'cat' or 'echo' is forked into the pipeline's group like a program.
+	//Of those only 'wait' and 'fg' can block, and they stop at the deadline.
+	builtin = findBuiltin(ast->words[ast->cmds[pipeline->cmd].argv]);
+	if(stages == 1 && bg_pids == NULL &&
+	   ((deadline == 0 && limits == NULL &&
+	     (builtin == NULL || ast->cmds[pipeline->cmd].sched == NULL)) ||
+	    (builtin != NULL && builtin->flags == BUILTIN_SPECIAL)))
+	{
+		wait_deadline = deadline;
+		exit_status = executeCmd(ast, &ast->cmds[pipeline->cmd]);
+		wait_deadline = 0;
+		return exit_status;
+	}
+	if(limits != NULL)
+	{
+		cg_fd = cgroupOpen(limits, cg_dir); //-1: rlimits only.
+	}
+	if(pin_mode && stages > 1)
+	{
+		pin = pinBase(); //-1: nothing to pin to.
+	}
+
+	for(i = 0; i < pipeline->ncmds; i++)
+	{
+		pids[i] = -1;
+		relays[i] = -1;
+		relay_statuses[i] = -1;
+	}
+	for(i = 0; i < stages; i++)
+	{
+		if(i == fan && fanPipe(prev_fd, pipeline->fanout,
+		                       (deadline != 0 && pgid > 0) ? pgid : -1, size,
+		                       branches, &fan_pid))
+		{
+			printf("Pipe failed to create.\n");
+			stages = i;
+			break;
+		}
+		if(i >= fan)
+		{
+			prev_fd = branches[i - fan]; //fanPipe() now owns the producer's.
+		}
+		else if(relay && prev_fd != -1) //stage i reads the relay, not i - 1.
+		{
+			prev_fd = relayPipe(prev_fd, i,
+			                    (deadline != 0 && pgid > 0) ? pgid : -1,
+			                    ast->words[ast->cmds[pipeline->cmd + i-1].argv],
+			                    ast->words[ast->cmds[pipeline->cmd + i].argv],
+			                    size, &relays[i-1]);
+		}
+		fd[0] = -1;
+		fd[1] = -1;
+		//close-on-exec: every child keeps only the ends dup'ed onto 0 and 1.
+		if(i < ((fan < stages) ? fan : stages - 1) && pipe2(fd, O_CLOEXEC) < 0)
+		{
+			perror("pipe");
+			printf("Pipe failed to create.\n");
+			stages = i;
+			break;
+		}
+		if(fd[1] != -1 && size > 0)
+		{
+			setPipeSize(fd[1], size);
+		}
+
+		setLaunch(&launch, ast, &ast->cmds[pipeline->cmd + i]);
+		launch.in_fd = prev_fd;
+		launch.out_fd = fd[1];
+		launch.lane = i + 1;
+		launch.limits = limits;
+		launch.cg_fd = cg_fd;
+		launch.cpu = (pin >= 0) ? pin_order[(pin + i) % pin_ncpus] : -1;
+		if(bg_pids != NULL || deadline != 0) //a timeout kills the whole group.
+		{
+			launch.pgid = pgid; //0 makes the first stage the group leader.
+		}
+
+		builtin = findBuiltin(launch.argv[0]);
+		if(builtin != NULL && inner == NULL && bg_pids == NULL &&
+		   deadline == 0 && limits == NULL && launch.sched == NULL &&
+		   builtin->flags == BUILTIN_PIPE_OK)
+		{
+			//The first such builtin runs inside the shell once every other
+			//stage is started, so its pipe ends are kept open until then.
+			inner = builtin;
+			inner_idx = i;
+			inner_launch = launch;
+			prev_fd = fd[0];
+			continue;
+		}
+		else if(builtin != NULL)
+		{
+			pids[i] = forkBuiltin(builtin, &launch);
+		}
+		else
+		{
+			pids[i] = launchCmd(&launch);
+		}
+		started[i] = launch.start_us;
+		if(pgid == 0 && pids[i] > 0)
+		{
+			pgid = pids[i];
+			if(deadline != 0 && interactive)
+			{
+				tcsetpgrp(STDIN_FILENO, pgid); //the group now owns the terminal.
+			}
+		}
+
+		//Parent: the pipe ends now belong to the children.
+		if(prev_fd != -1)
+		{
+			close(prev_fd);
+		}
+		if(fd[1] != -1)
+		{
+			close(fd[1]); //close writing end
+		}
+		prev_fd = fd[0]; //a stage that failed to start just reads EOF.
+	}
+	if(prev_fd != -1)
+	{
+		close(prev_fd);
+	}
+
+	if(bg_pids != NULL)
+	{
+		memcpy(bg_pids, pids, pipeline->ncmds * sizeof(pid_t));
+		return EXIT_SUCCESS;
+	}
+
+	if(inner != NULL)
+	{
+		status = runBuiltin(inner, &inner_launch);
+		if(inner_launch.in_fd != -1)
+		{
+			close(inner_launch.in_fd);
+		}
+		if(inner_launch.out_fd != -1)
+		{
+			close(inner_launch.out_fd); //the next stage now sees EOF.
+		}
+		if(inner_idx == stages - 1)
+		{
+			exit_status = status;
+		}
+	}
+
+	for(i = 0; i < stages; i++)
+	{
+		statuses[i] = -1;
+	}
+	//In the order they end, and whatever runs past the deadline is killed.
+	timed_out = superReap(pids, stages, statuses, ended, deadline) > 0;
+	if(timed_out)
+	{
+		killPipe(pgid, pids, stages, statuses, ended);
+	}
+	if(relay)
+	{
+		superReap(relays, pipeline->ncmds, relay_statuses, NULL, 0);
+	}
+	if(fan_pid > 0)
+	{
+		superReap(&fan_pid, 1, &fan_status, NULL, 0);
+	}
+	if(deadline != 0 && interactive && pgid > 0)
+	{
+		tcsetpgrp(STDIN_FILENO, getpgrp());
+	}
+	if(cg_fd != -1)
+	{
+		cgroupClose(cg_dir, cg_fd, ast->words[ast->cmds[pipeline->cmd].argv]);
+	}
+	for(i = 0; i < stages; i++)
+	{
+		if(TRACING && pids[i] > 0)
+		{
+			traceEvent(ast->words[ast->cmds[pipeline->cmd + i].argv], i + 1,
+			           started[i], ended[i], pids[i]);
+		}
+	}
+	if(timed_out)
+	{
+		fprintf(stderr, "timeout: %s: timed out\n",
+		        ast->words[ast->cmds[pipeline->cmd].argv]);
+		exit_status = TIMEOUT_STATUS; //'&&' stops here like on any failure.
+	}
+	else if(stages > 0 && pids[stages - 1] > 0)
+	{
+		exit_status = exitStatus(statuses[stages - 1]);
+	}
+	if(TRACING) traceMark("wait", 0, 0);
+
+	return exit_status;
+}
+
+/*
+ *******************************************************************************
+ * setPipeSize() sets the capacity of a pipe with F_SETPIPE_SZ, at most        *
+ * /proc/sys/fs/pipe-max-size. The kernel rounds it up to a power of two       *
+ * pages. A pipe that cannot grow, because the user has too many large pipes,  *
+ * keeps its 64 KB.                                                            *
+ *******************************************************************************
+ */
+void setPipeSize(int fd, long size)
+{
+	static long max = 0;
+
+	if(max == 0)
+	{
+		max = readLong("/proc/sys/fs/pipe-max-size");
+		max = (max > 0) ? max : 1048576;
+	}
+	fcntl(fd, F_SETPIPE_SZ, (int)((size < max) ? size : max));
+}
+
+/*
+ *******************************************************************************
+ * relayPipe() puts a relay on the pipe between two stages for -R. in_fd is    *
+ * the read end of the pipe that stage n - 1 writes. A forked relay splices    *
+ * from it into a new pipe, whose read end it returns for stage n. When the    *
+ * data ends the relay prints to stderr how many bytes went through, and how   *
+ * long it waited for the writer (the pipe was empty) and for the reader (the  *
+ * pipe was full). The relay joins pgid unless it is -1, and its pid goes to   *
+ * *pid. On an error the pipe is left as it is and in_fd is returned.          *
+ *******************************************************************************
+ */
+int relayPipe(int in_fd, int n, pid_t pgid, const char *from, const char *to,
+              long size, pid_t *pid)
+{
+	struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+	long long bytes = 0, writer_us = 0, reader_us = 0, start, t;
+	int out[2];
+	ssize_t moved;
+
+	if(pipe2(out, O_CLOEXEC) < 0)
+	{
+		perror("pipe");
+		return in_fd;
+	}
+	if(size > 0)
+	{
+		setPipeSize(out[1], size);
+	}
+
+	fflush(stdout);
+	*pid = fork();
+	if(*pid < 0)
+	{
+		perror("fork");
+		close(out[0]);
+		close(out[1]);
+		return in_fd;
+	}
+	else if(*pid > 0) //Parent: the pipe ends now belong to the relay.
+	{
+		if(pgid != -1)
+		{
+			setpgid(*pid, pgid);
+		}
+		close(in_fd);
+		close(out[1]);
+		return out[0];
+	}
+
+	if(pgid != -1) //Child: the relay.
+	{
+		setpgid(0, pgid);
+	}
+	resetSignals();
+	signal(SIGPIPE, SIG_IGN); //a reader that is gone ends it with EPIPE.
+	dup2(in_fd, STDIN_FILENO);
+	dup2(out[1], STDOUT_FILENO);
+	closefrom(STDERR_FILENO + 1);
+
+	start = nowUs();
+	do
+	{
+		t = nowUs();
+		while(poll(&pfd, 1, -1) < 0 && errno == EINTR);
+		writer_us += nowUs() - t;
+		t = nowUs();
+		moved = splice(STDIN_FILENO, NULL, STDOUT_FILENO, NULL, COPY_CHUNK,
+		               SPLICE_F_MOVE);
+		reader_us += nowUs() - t;
+		bytes += (moved > 0) ? moved : 0;
+	} while(moved > 0 || (moved < 0 && errno == EINTR));
+
+	t = nowUs() - start;
+	fprintf(stderr, "pipe %d (%s | %s): %lld bytes in %.3f s, %.1f MB/s, "
+	        "waited %.3f s for %s and %.3f s for %s\n", n, from, to, bytes,
+	        t / 1e6, (t > 0) ? bytes / (t / 1e6) / 1048576 : 0.0,
+	        writer_us / 1e6, from, reader_us / 1e6, to);
+	_exit(EXIT_SUCCESS);
+}
+
+/*
+ *******************************************************************************
+ * fanPipe() starts the process that copies the output of the producer of a    *
+ * '|& {...}' pipeline to its n branches. in_fd is the read end of the         *
+ * producer's pipe and the read ends of the n new pipes go to fds. The forked  *
+ * process never brings the data into user space: each block, at most what the *
+ * private copy pipe holds, is tee()d from in_fd into that pipe and spliced    *
+ * from there into a branch, once per branch with teeAll(), and then spliced   *
+ * from in_fd to /dev/null. So a slow branch holds back the others and in the  *
+ * end the producer, like a slow stage of a plain pipeline. A branch that has  *
+ * gone is left out, and when all of them are gone the producer gets SIGPIPE.  *
+ * A copy that fails in a way that would give a branch the wrong bytes ends    *
+ * the process, so the branches see the end of their input. The process joins  *
+ * pgid unless it is -1 and its pid goes to *pid. It returns 0, or 1 (with     *
+ * nothing open) when a pipe or the fork failed.                               *
+ *******************************************************************************
+ */
+int fanPipe(int in_fd, int n, pid_t pgid, long size, int *fds, pid_t *pid)
+{
+	int outs[n], live = n, copied, left, null_fd, copy[2], fd[2], chunk, i;
+	ssize_t got;
+
+	for(i = 0; i < n; i++)
+	{
+		if(pipe2(fd, O_CLOEXEC) < 0)
+		{
+			perror("pipe");
+			while(i-- > 0)
+			{
+				close(fds[i]);
+				close(outs[i]);
+			}
+			return 1;
+		}
+		fds[i] = fd[0];
+		outs[i] = fd[1];
+		if(size > 0)
+		{
+			setPipeSize(fd[1], size);
+		}
+	}
+
+	fflush(stdout);
+	*pid = fork();
+	if(*pid != 0) //Parent: the producer's pipe and the writing ends go.
+	{
+		if(*pid < 0)
+		{
+			perror("fork");
+			for(i = 0; i < n; i++)
+			{
+				close(fds[i]);
+			}
+		}
+		else
+		{
+			if(pgid != -1)
+			{
+				setpgid(*pid, pgid);
+			}
+			close(in_fd);
+		}
+		for(i = 0; i < n; i++)
+		{
+			close(outs[i]);
+		}
+		return *pid < 0;
+	}
+
+	if(pgid != -1) //Child: the input becomes 0 and the branches 3..n+2.
+	{
+		setpgid(0, pgid);
+	}
+	resetSignals();
+	signal(SIGPIPE, SIG_IGN); //a branch that is gone fails with EPIPE.
+	for(i = 0; i < n; i++) //above the range first, so none is overwritten.
+	{
+		outs[i] = fcntl(outs[i], F_DUPFD, n + 3);
+	}
+	dup2(in_fd, STDIN_FILENO);
+	for(i = 0; i < n; i++)
+	{
+		dup2(outs[i], i + 3);
+		outs[i] = i + 3;
+	}
+	closefrom(n + 3);
+	null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+	if(null_fd < 0 || pipe2(copy, O_CLOEXEC) < 0)
+	{
+		perror("fan-out");
+		_exit(EXIT_FAILURE);
+	}
+	//The copy pipe may not grow, so a block is what it really holds.
+	fcntl(copy[1], F_SETPIPE_SZ, fcntl(STDIN_FILENO, F_GETPIPE_SZ));
+	chunk = fcntl(copy[1], F_GETPIPE_SZ);
+	if(chunk <= 0)
+	{
+		perror("fan-out");
+		_exit(EXIT_FAILURE);
+	}
+
+	while(live > 0)
+	{
+		got = tee(STDIN_FILENO, copy[1], chunk, 0); //waits for data.
+		if(got < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		else if(got <= 0)
+		{
+			break; //end of the data, or in_fd is not a pipe.
+		}
+		copied = 1;
+		for(i = 0; i < n; i++)
+		{
+			if(outs[i] == -1)
+			{
+				continue;
+			}
+			left = copied ? (spliceAll(copy[0], outs[i], got) ? 1 : 0) :
+			       teeAll(STDIN_FILENO, copy, outs[i], null_fd, got);
+			copied = 0;
+			if(left > 0)
+			{
+				close(outs[i]);
+				outs[i] = -1;
+				live--;
+				if(ioctl(copy[0], FIONREAD, &left) < 0 ||
+				   spliceAll(copy[0], null_fd, left))
+				{
+					left = -1; //the copy pipe is not empty for the next.
+				}
+			}
+			if(left < 0) //the branches would get the wrong bytes.
+			{
+				perror("fan-out");
+				_exit(EXIT_FAILURE);
+			}
+		}
+		if(copied)
+		{
+			break; //no branch left to copy to.
+		}
+		if(spliceAll(STDIN_FILENO, null_fd, got)) //the block is done.
+		{
+			perror("fan-out");
+			_exit(EXIT_FAILURE);
+		}
+	}
+	_exit(EXIT_SUCCESS);
+}
+
+/*
+ *******************************************************************************
+ * spliceAll() moves len bytes from the pipe from to to with splice(), waiting *
+ * for room in to. It returns 0, or 1 when to is gone.                         *
+ *******************************************************************************
+ */
+int spliceAll(int from, int to, size_t len)
+{
+	ssize_t moved;
+
+	while(len > 0)
+	{
+		moved = splice(from, NULL, to, NULL, len, SPLICE_F_MOVE);
+		if(moved < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		else if(moved <= 0)
+		{
+			return 1;
+		}
+		len -= moved;
+	}
+
+	return 0;
+}
+
+/*
+ *******************************************************************************
+ * teeAll() copies the first len bytes of the pipe from to the pipe to,        *
+ * through the empty pipe copy, and leaves them in from. tee() always starts   *
+ * at the head of from, so after a short tee() the bytes that were already     *
+ * sent are spliced from copy to null_fd and the rest is asked for again. It   *
+ * returns 0, 1 when to is gone, or -1 when tee() fails or stops making        *
+ * progress.                                                                   *
+ *******************************************************************************
+ */
+int teeAll(int from, int *copy, int to, int null_fd, size_t len)
+{
+	size_t sent = 0;
+	ssize_t got;
+
+	while(sent < len)
+	{
+		got = tee(from, copy[1], len, 0);
+		if(got < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		else if(got <= (ssize_t)sent || spliceAll(copy[0], null_fd, sent))
+		{
+			return -1;
+		}
+		if(spliceAll(copy[0], to, got - sent))
+		{
+			return 1;
+		}
+		sent = got;
+	}
+
+	return 0;
+}
+
+/*
+ *******************************************************************************
+ * pipeDeadline() returns the nowUs() time by which a foreground pipeline has  *
+ * to end: the earlier of its own 'timeout' and the deadline of the line (-w), *
+ * or 0 when it has neither.                                                   *
+ *******************************************************************************
+ */
+long long pipeDeadline(Pipeline *pipeline)
+{
+	long long deadline = 0;
+
+	if(pipeline->timeout_us > 0)
+	{
+		deadline = nowUs() + pipeline->timeout_us;
+	}
+	if(line_deadline != 0 && (deadline == 0 || line_deadline < deadline))
+	{
+		deadline = line_deadline;
+	}
+
+	return deadline;
+}
+
+/*
+ *******************************************************************************
+ * killPipe() ends a pipeline that ran past its deadline. Its process group    *
+ * pgid gets SIGTERM (and SIGCONT, in case it is stopped), and if anything is  *
+ * still running TIMEOUT_GRACE later the group gets SIGKILL. The stages are    *
+ * reaped into statuses[] like superReap() does.                               *
+ *******************************************************************************
+ */
+void killPipe(pid_t pgid, pid_t *pids, int n, int *statuses, long long *ended)
+{
+	kill(-pgid, SIGTERM);
+	kill(-pgid, SIGCONT);
+	if(superReap(pids, n, statuses, ended, nowUs() + TIMEOUT_GRACE) > 0)
+	{
+		kill(-pgid, SIGKILL);
+		superReap(pids, n, statuses, ended, 0);
+	}
+}
+
+/*
+ *******************************************************************************
+ * prefixEnd() tells if args[i], a 'limit' or a 'sched', starts a prefix like  *
+ * 'limit SPEC... -- cmd'. It returns the index of the '--', or 0 when there   *
+ * is no '--' with a command after it and the word is only a command name.     *
+ *******************************************************************************
+ */
+int prefixEnd(Token *args, int i)
+{
+	int end = i + 1;
+
+	while(args[end].type == TOK_WORD && strcmp(args[end].text, "--"))
+	{
+		end++;
+	}
+	if(end == i + 1 || args[end].type != TOK_WORD ||
+	   args[end+1].type != TOK_WORD)
+	{
+		return 0;
+	}
+
+	return end;
+}
+
+/*
+ *******************************************************************************
+ * parseLimits() reads a comma separated list of limits, like                  *
+ * "mem=512M,cpu=10", into limits and leaves the ones it does not name as they *
+ * are. mem is in bytes with an optional K, M, G or T, cpu is seconds of CPU   *
+ * time of every process, nproc a number of processes and cpus a share of the  *
+ * CPUs, like 0.5, that only a cgroup can enforce. It returns 1 on a bad list. *
+ *******************************************************************************
+ */
+int parseLimits(Limits *limits, const char *spec)
+{
+	const char *value;
+	char key[8], *end;
+	double number;
+	size_t len;
+
+	while(*spec != '\0')
+	{
+		value = strchr(spec, '=');
+		len = (value != NULL) ? (size_t)(value - spec) : 0;
+		if(len == 0 || len >= sizeof(key))
+		{
+			return 1;
+		}
+		memcpy(key, spec, len);
+		key[len] = '\0';
+		value++;
+
+		if(!strcmp(key, "mem"))
+		{
+			number = parseSize(value, &end);
+		}
+		else
+		{
+			number = strtod(value, &end);
+		}
+		if(end == value || !(number >= 0) || number > 1e15 ||
+		   (*end != ',' && *end != '\0'))
+		{
+			return 1;
+		}
+
+		if(!strcmp(key, "mem"))
+		{
+			limits->mem = (long long)number;
+		}
+		else if(!strcmp(key, "cpu"))
+		{
+			limits->cpu = (long long)(number + 0.999); //RLIMIT_CPU has seconds.
+		}
+		else if(!strcmp(key, "nproc"))
+		{
+			limits->nproc = (long long)number;
+		}
+		else if(!strcmp(key, "cpus"))
+		{
+			limits->cpus = (long long)(number * 1000 + 0.5);
+		}
+		else
+		{
+			return 1;
+		}
+		spec = (*end == ',') ? end + 1 : end;
+	}
+
+	return 0;
+}
+
+/*
+ *******************************************************************************
+ * parseSize() reads a number of bytes with an optional K, M, G or T (binary   *
+ * multiples), like "512M" or "1.5g", and leaves *end after it, like strtod(). *
+ * It returns -1, with *end at text, when there is no number.                  *
+ *******************************************************************************
+ */
+long long parseSize(const char *text, char **end)
+{
+	static const char units[] = "KMGT";
+	const char *unit;
+	double number = strtod(text, end);
+
+	if(*end == text || !(number >= 0) || number > 1e15)
+	{
+		*end = (char*)text;
+		return -1;
+	}
+	unit = (**end != '\0') ? strchr(units, toupper((unsigned char)**end)) : NULL;
+	if(unit != NULL)
+	{
+		number *= (double)(1LL << (10 * (unit - units + 1)));
+		(*end)++;
+	}
+
+	return (long long)number;
+}
+
+/*
+ *******************************************************************************
+ * pipeLimits() returns the limits of a pipeline: its 'limit' prefix, or else  *
+ * the -l limits of the batch, or NULL when there are none.                    *
+ *******************************************************************************
+ */
+const Limits* pipeLimits(Pipeline *pipeline)
+{
+	if(pipeline->limits != NULL)
+	{
+		return pipeline->limits;
+	}
+	if(limits_default.mem > 0 || limits_default.cpu > 0 ||
+	   limits_default.nproc > 0 || limits_default.cpus > 0)
+	{
+		return &limits_default;
+	}
+
+	return NULL;
+}
+
+/*
+ *******************************************************************************
+ * parseSched() reads one word of a 'sched' prefix into sched. cpu= is a list  *
+ * of CPUs like "0-3,8", nice= a nice value from -20 to 19, policy= one of     *
+ * other, batch and idle, and io= an I/O class, idle or be or rt, with an      *
+ * optional level like "be:7". It returns 1 on a bad word.                     *
+ *******************************************************************************
+ */
+int parseSched(Sched *sched, const char *spec)
+{
+	const char *value = strchr(spec, '=');
+	char *end;
+	long number;
+	int class;
+
+	if(value == NULL)
+	{
+		return 1;
+	}
+	value++;
+
+	if(!strncmp(spec, "cpu=", 4))
+	{
+		return parseCpus(value, &sched->cpus);
+	}
+	else if(!strncmp(spec, "nice=", 5))
+	{
+		number = strtol(value, &end, 10);
+		if(end == value || *end != '\0' || number < -20 || number > 19)
+		{
+			return 1;
+		}
+		sched->nice = (int)number;
+	}
+	else if(!strncmp(spec, "policy=", 7))
+	{
+		if(!strcmp(value, "other"))
+		{
+			sched->policy = SCHED_OTHER;
+		}
+		else if(!strcmp(value, "batch"))
+		{
+			sched->policy = SCHED_BATCH;
+		}
+		else if(!strcmp(value, "idle"))
+		{
+			sched->policy = SCHED_IDLE;
+		}
+		else
+		{
+			return 1;
+		}
+	}
+	else if(!strncmp(spec, "io=", 3))
+	{
+		if(!strncmp(value, "rt", 2))
+		{
+			class = 1;
+		}
+		else if(!strncmp(value, "be", 2))
+		{
+			class = 2;
+		}
+		else if(!strncmp(value, "idle", 4))
+		{
+			class = 3;
+		}
+		else
+		{
+			return 1;
+		}
+		value += (class == 3) ? 4 : 2;
+		number = 4; //the kernel's default level.
+		if(*value == ':')
+		{
+			number = strtol(value + 1, &end, 10);
+			value = (end == value + 1) ? "?" : end;
+		}
+		if(*value != '\0' || number < 0 || number > 7)
+		{
+			return 1;
+		}
+		sched->ioprio = (class << IOPRIO_CLASS_SHIFT) |
+		                ((class == 3) ? 0 : (int)number);
+	}
+	else
+	{
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ *******************************************************************************
+ * parseCpus() reads a list of CPUs and CPU ranges, like "0-3,8", into cpus.   *
+ * It returns 1 on a bad list.                                                 *
+ *******************************************************************************
+ */
+int parseCpus(const char *list, cpu_set_t *cpus)
+{
+	long first, last;
+	char *end;
+
+	CPU_ZERO(cpus);
+	do
+	{
+		first = strtol(list, &end, 10);
+		last = first;
+		if(end != list && *end == '-')
+		{
+			list = end + 1;
+			last = strtol(list, &end, 10);
+		}
+		if(end == list || first < 0 || last < first || last >= CPU_SETSIZE ||
+		   (*end != ',' && *end != '\0'))
+		{
+			return 1;
+		}
+		for(; first <= last; first++)
+		{
+			CPU_SET(first, cpus);
+		}
+		list = end + 1;
+	} while(*end == ',');
+
+	return 0;
+}
+
+/*
+ *******************************************************************************
+ * setLaunch() fills a Launch with the argv and the '<' and '>' targets of a   *
+ * command and its 'sched' prefix. It has no pipe ends, no limits, no pinned   *
+ * CPU and it stays in the shell's process group.                              *
+ *******************************************************************************
+ */
+void setLaunch(Launch *launch, Ast *ast, Command *cmd)
+{
+	launch->argv = &ast->words[cmd->argv];
+	launch->in_fd = -1;
+	launch->out_fd = -1;
+	launch->in_file = (cmd->in != NO_WORD) ? ast->words[cmd->in] : NULL;
+	launch->out_file = (cmd->out != NO_WORD) ? ast->words[cmd->out] : NULL;
+	launch->pgid = -1;
+	launch->limits = NULL;
+	launch->cg_fd = -1;
+	launch->sched = cmd->sched;
+	launch->cpu = -1;
+	launch->lane = 1;
+	launch->start_us = 0;
+}
+
+/*
+ *******************************************************************************
+ * exitStatus() turns a wait status into a shell exit status: the exit code of *
+ * a normal exit, or 128 plus the signal number for a child killed by a        *
+ * signal.                                                                     *
+ *******************************************************************************
+ */
+int exitStatus(int status)
+{
+	if(WIFSIGNALED(status))
+	{
+		return 128 + WTERMSIG(status);
+	}
+	return WEXITSTATUS(status);
+}
+
+/*
+ *******************************************************************************
+ * timePipe() runs a pipeline that is prefixed with 'time' and prints to       *
+ * stderr, like bash, the wall time and the CPU time of its stages, and also   *
+ * their largest resident set and their context switches. Builtins that run    *
+ * inside the shell only count in the wall time.                               *
+ *******************************************************************************
+ */
+int timePipe(Ast *ast, Pipeline *pipeline)
+{
+	Usage outer = usage;
+	long long start_us = nowUs();
+	int exit_status;
+
+	memset(&usage, 0, sizeof(usage));
+	exit_status = pipeline->memo ? memoPipe(ast, pipeline) :
+	              executePipe(ast, pipeline, NULL);
+	usage.real_us = nowUs() - start_us;
+	printUsage(&usage);
+
+	usage.real_us = 0;
+	addUsage(&outer, &usage); //the line still counts the pipeline.
+	usage = outer;
+
+	return exit_status;
+}
+
+/*
+ *******************************************************************************
+ * memoPipe() runs a pipeline that is prefixed with 'memo'. The pipeline is    *
+ * looked up in the memo cache by memoKey(). On a hit nothing runs: the stdout *
+ * that was cached is copied to the '>' target of the last stage, or to the    *
+ * shell's stdout, and the exit status that was cached is returned. On a miss  *
+ * the pipeline runs with its stdout going to a new cache entry, which is then *
+ * copied to where the stdout belongs and kept, unless a stage could not be    *
+ * started, the pipeline timed out (exit status 124, or 126 and above) or one  *
+ * of its files changed less than MEMO_SETTLE ago. A pipeline that memoKey()   *
+ * refuses runs as if it had no 'memo'.                                        *
+ *******************************************************************************
+ */
+int memoPipe(Ast *ast, Pipeline *pipeline)
+{
+	static char key[MEMO_KEY];
+	char path[PATH_MAX], tmp[PATH_MAX + 32];
+	Command *last = &ast->cmds[pipeline->cmd + pipeline->ncmds - 1];
+	const char *dir;
+	unsigned long long hash = 14695981039346656037ULL; //FNV-1a.
+	MemoHead head;
+	struct stat st;
+	unsigned long errors = launch_errors;
+	struct timespec now;
+	long long newest;
+	size_t len, i;
+	int fd, out_fd, saved, exit_status, out, settled;
+
+	if(memoKey(ast, pipeline, key, &len, &newest) ||
+	   (dir = memoDir()) == NULL)
+	{
+		return executePipe(ast, pipeline, NULL);
+	}
+	//A file changed in the last MEMO_SETTLE may change again within the
+	//same timestamp and keep its key, so its output is not kept yet.
+	clock_gettime(CLOCK_REALTIME, &now);
+	settled = newest < now.tv_sec * 1000000000LL + now.tv_nsec - MEMO_SETTLE;
+	for(i = 0; i < len; i++)
+	{
+		hash = (hash ^ (unsigned char)key[i]) * 1099511628211ULL;
+	}
+	snprintf(path, sizeof(path), "%s/%016llx", dir, hash);
+	snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid());
+
+	out_fd = STDOUT_FILENO;
+	if(last->out != NO_WORD &&
+	   (out_fd = creat(ast->words[last->out], 0644)) < 0)
+	{
+		perror(ast->words[last->out]);
+		return EXIT_FAILURE;
+	}
+	fflush(stdout);
+
+	fd = memoHit(path, key, len, &head);
+	if(fd >= 0) //a hit: only the output is copied.
+	{
+		copyFd(fd, out_fd);
+		close(fd);
+		if (TRACING) traceMark("memo", 0, 0);
+		exit_status = head.status;
+	}
+	else if((fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) < 0)
+	{
+		exit_status = executePipe(ast, pipeline, NULL); //no cache today.
+		if(out_fd != STDOUT_FILENO) //it opens the '>' target itself.
+		{
+			close(out_fd);
+			out_fd = STDOUT_FILENO;
+		}
+	}
+	else
+	{
+		memset(&head, 0, sizeof(head));
+		memcpy(head.magic, MEMO_MAGIC, sizeof(head.magic));
+		head.key_len = len;
+		writeAll(fd, (char*)&head, sizeof(head));
+		writeAll(fd, key, len);
+
+		out = last->out; //the stages write to the entry instead.
+		last->out = NO_WORD;
+		saved = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 3);
+		dup2(fd, STDOUT_FILENO);
+		exit_status = executePipe(ast, pipeline, NULL);
+		fflush(stdout);
+		dup2(saved, STDOUT_FILENO);
+		close(saved);
+		last->out = out;
+
+		lseek(fd, sizeof(head) + len, SEEK_SET);
+		copyFd(fd, out_fd);
+		if(exit_status < 126 && exit_status != TIMEOUT_STATUS && settled &&
+		   launch_errors == errors && fstat(fd, &st) == 0)
+		{
+			head.out_len = st.st_size - sizeof(head) - len;
+			head.status = exit_status;
+			if(pwrite(fd, &head, sizeof(head), 0) == sizeof(head) &&
+			   rename(tmp, path) == 0)
+			{
+				memo_used = (memo_used < 0) ? -1 : memo_used + st.st_size;
+				tmp[0] = '\0';
+			}
+		}
+		if(tmp[0] != '\0')
+		{
+			unlink(tmp);
+		}
+		close(fd);
+		if(memo_used < 0 || memo_used > memo_max)
+		{
+			memoTrim(dir);
+		}
+	}
+
+	if(out_fd != STDOUT_FILENO)
+	{
+		close(out_fd);
+	}
+	return exit_status;
+}
+
+/*
+ *******************************************************************************
+ * memoKey() writes to key, NUL separated, what the output of a pipeline may   *
+ * depend on: the current directory, the MEMO_VARS variables of the            *
+ * environment, the words of every stage and the files that it reads, each     *
+ * with its device, inode, size, mtime and ctime, so an input that is          *
+ * rewritten is a new key. Those files are every '<' target, every word that   *
+ * names a regular file or a directory, and the shell's stdin, with its        *
+ * offset, when a first stage without '<' reads it; a stdin of /dev/null is    *
+ * also fine. It returns 1 for a pipeline that cannot be memoized, one with a  *
+ * fan-out, a '>' before the last stage, a builtin that changes the shell, a   *
+ * '<' target that is not a regular file, a word that names a device or a      *
+ * FIFO, any other stdin, or a key longer than MEMO_KEY.                       *
+ *******************************************************************************
+ */
+int memoKey(Ast *ast, Pipeline *pipeline, char *key, size_t *len,
+            long long *newest)
+{
+	static const char *vars[] = {MEMO_VARS, NULL};
+	char text[PATH_MAX + 64];
+	const Builtin *builtin;
+	const char *value;
+	struct stat st, null;
+	Command *cmd;
+	int i, j, full = 0;
+
+	if(pipeline->fanout > 0 || getcwd(text, sizeof(text)) == NULL)
+	{
+		return 1;
+	}
+	*len = 0;
+	*newest = 0;
+	full |= memoAdd(key, len, MEMO_MAGIC);
+	full |= memoAdd(key, len, text);
+	for(i = 0; vars[i] != NULL; i++)
+	{
+		value = getenv(vars[i]);
+		snprintf(text, sizeof(text), "%s%s%s", vars[i], value ? "=" : "",
+		         value ? value : "");
+		full |= memoAdd(key, len, text);
+	}
+
+	for(i = 0; i < pipeline->ncmds; i++)
+	{
+		cmd = &ast->cmds[pipeline->cmd + i];
+		builtin = findBuiltin(ast->words[cmd->argv]);
+		if((builtin != NULL && builtin->flags == BUILTIN_SPECIAL) ||
+		   (cmd->out != NO_WORD && i < pipeline->ncmds - 1))
+		{
+			return 1;
+		}
+		for(j = cmd->argv; ast->words[j] != NULL; j++)
+		{
+			full |= memoAdd(key, len, ast->words[j]);
+			if(stat(ast->words[j], &st) < 0)
+			{
+				continue; //not a file, as far as the shell can tell.
+			}
+			if(!S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode))
+			{
+				return 1; //a device or a FIFO, like /dev/urandom.
+			}
+			full |= memoStat(key, len, "=", &st, newest);
+		}
+		if(cmd->in != NO_WORD)
+		{
+			if(stat(ast->words[cmd->in], &st) < 0 || !S_ISREG(st.st_mode))
+			{
+				return 1;
+			}
+			full |= memoStat(key, len, "<", &st, newest);
+			full |= memoAdd(key, len, ast->words[cmd->in]);
+		}
+		else if(i == 0) //it reads the shell's stdin.
+		{
+			if(fstat(STDIN_FILENO, &st) < 0)
+			{
+				return 1;
+			}
+			if(S_ISREG(st.st_mode)) //from where the shell's offset is.
+			{
+				full |= memoStat(key, len, "<&", &st, newest);
+				snprintf(text, sizeof(text), "%lld",
+				         (long long)lseek(STDIN_FILENO, 0, SEEK_CUR));
+			}
+			else if(S_ISCHR(st.st_mode) && stat("/dev/null", &null) == 0 &&
+			        st.st_rdev == null.st_rdev)
+			{
+				snprintf(text, sizeof(text), "<& /dev/null");
+			}
+			else
+			{
+				return 1; //a pipe or a terminal gives something new each time.
+			}
+			full |= memoAdd(key, len, text);
+		}
+		full |= memoAdd(key, len, "|");
+	}
+
+	return full;
+}
+
+/*
+ *******************************************************************************
+ * memoStat() appends to the key of memoKey() a file that the pipeline reads:  *
+ * its device, inode, size, mtime and ctime after tag. The newest ctime of the *
+ * key is kept in *newest for memoPipe(). It returns 1 when the key would be   *
+ * longer than MEMO_KEY.                                                       *
+ *******************************************************************************
+ */
+int memoStat(char *key, size_t *len, const char *tag, const struct stat *st,
+             long long *newest)
+{
+	char text[160];
+	long long changed = st->st_ctim.tv_sec * 1000000000LL + st->st_ctim.tv_nsec;
+
+	*newest = (changed > *newest) ? changed : *newest;
+	snprintf(text, sizeof(text), "%s %lx %lx %lld %ld.%09ld %lld", tag,
+	         (unsigned long)st->st_dev, (unsigned long)st->st_ino,
+	         (long long)st->st_size, (long)st->st_mtim.tv_sec,
+	         st->st_mtim.tv_nsec, changed);
+	return memoAdd(key, len, text);
+}
+
+/*
+ *******************************************************************************
+ * memoAdd() appends text and its NUL to the key of memoKey(). It returns 1    *
+ * when the key would be longer than MEMO_KEY.                                 *
+ *******************************************************************************
+ */
+int memoAdd(char *key, size_t *len, const char *text)
+{
+	size_t n = strlen(text) + 1;
+
+	if(*len + n > MEMO_KEY)
+	{
+		return 1;
+	}
+	memcpy(key + *len, text, n);
+	*len += n;
+	return 0;
+}
+
+/*
+ *******************************************************************************
+ * memoDir() returns the directory of the memo cache, which it makes the first *
+ * time: $MYSHELL_MEMO, else $XDG_CACHE_HOME/myshell-memo, else                *
+ * ~/.cache/myshell-memo. It returns NULL when there is none to be had, which  *
+ * is reported the first time only.                                            *
+ *******************************************************************************
+ */
+const char* memoDir(void)
+{
+	static char dir[PATH_MAX];
+	static int failed = 0;
+	const char *env = getenv(MEMO_ENV), *base;
+
+	if(dir[0] != '\0' || failed)
+	{
+		return failed ? NULL : dir;
+	}
+	if(env != NULL && env[0] != '\0')
+	{
+		snprintf(dir, sizeof(dir), "%s", env);
+	}
+	else if((base = getenv("XDG_CACHE_HOME")) != NULL && base[0] != '\0')
+	{
+		snprintf(dir, sizeof(dir), "%s/myshell-memo", base);
+	}
+	else if((base = getenv("HOME")) != NULL && base[0] != '\0')
+	{
+		snprintf(dir, sizeof(dir), "%s/.cache", base);
+		mkdir(dir, 0700);
+		snprintf(dir, sizeof(dir), "%s/.cache/myshell-memo", base);
+	}
+	if(dir[0] == '\0' || (mkdir(dir, 0700) < 0 && errno != EEXIST))
+	{
+		if(dir[0] != '\0')
+		{
+			perror(dir); //once: the lines after it just run.
+		}
+		dir[0] = '\0';
+		failed = 1;
+		return NULL;
+	}
+	return dir;
+}
+
+/*
+ *******************************************************************************
+ * memoHit() opens the cache entry at path and checks that it is whole and     *
+ * that it was stored for this key, since two keys may share a hash. Its mtime *
+ * becomes now, which is what memoTrim() evicts by. It returns the entry       *
+ * positioned at the cached stdout, with its head in *head, or -1 on a miss.   *
+ *******************************************************************************
+ */
+int memoHit(const char *path, const char *key, size_t len, MemoHead *head)
+{
+	static char stored[MEMO_KEY];
+	struct stat st;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+	if(fd < 0)
+	{
+		return -1;
+	}
+	if(readAll(fd, (char*)head, sizeof(*head)) ||
+	   memcmp(head->magic, MEMO_MAGIC, sizeof(head->magic)) ||
+	   head->key_len != len || readAll(fd, stored, len) ||
+	   memcmp(stored, key, len) || fstat(fd, &st) < 0 ||
+	   st.st_size != (off_t)(sizeof(*head) + len + head->out_len))
+	{
+		close(fd);
+		return -1;
+	}
+	futimens(fd, NULL);
+	return fd;
+}
+
+/*
+ *******************************************************************************
+ * memoTrim() measures the memo cache and, when it is larger than -M (MEMO_MAX *
+ * by default), deletes the entries used least recently until it is down to    *
+ * three quarters of that. The size is then kept up to date by memoPipe() as   *
+ * entries are added, so the directory is only read again when it is full.     *
+ *******************************************************************************
+ */
+void memoTrim(const char *dir)
+{
+	MemoFile *files = NULL, *grown;
+	DIR *d = opendir(dir);
+	struct dirent *ent;
+	struct stat st;
+	size_t n = 0, cap = 0, i;
+
+	if(d == NULL)
+	{
+		return;
+	}
+	memo_used = 0;
+	while((ent = readdir(d)) != NULL)
+	{
+		if(strlen(ent->d_name) != 16 ||
+		   fstatat(dirfd(d), ent->d_name, &st, 0) < 0 || !S_ISREG(st.st_mode))
+		{
+			continue; //not an entry, or one being written.
+		}
+		if(n == cap)
+		{
+			cap = 2 * cap + 64;
+			grown = (MemoFile*)realloc(files, cap * sizeof(MemoFile));
+			if(grown == NULL)
+			{
+				break;
+			}
+			files = grown;
+		}
+		memcpy(files[n].name, ent->d_name, sizeof(files[n].name));
+		files[n].size = st.st_size;
+		files[n].used_ns = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+		memo_used += st.st_size;
+		n++;
+	}
+
+	if(memo_used > memo_max)
+	{
+		qsort(files, n, sizeof(MemoFile), memoOlder);
+		for(i = 0; i < n && memo_used > memo_max / 4 * 3; i++)
+		{
+			if(unlinkat(dirfd(d), files[i].name, 0) == 0)
+			{
+				memo_used -= files[i].size;
+			}
+		}
+	}
+	closedir(d);
+	free(files);
+}
+
+/*
+ *******************************************************************************
+ * memoOlder() orders the entries of memoTrim() by their last use, oldest      *
+ * first, for qsort().                                                         *
+ *******************************************************************************
+ */
+int memoOlder(const void *a, const void *b)
+{
+	const MemoFile *x = (const MemoFile*)a, *y = (const MemoFile*)b;
+
+	return (x->used_ns > y->used_ns) - (x->used_ns < y->used_ns);
+}
+
+/*
+ *******************************************************************************
+ * nowUs() returns the monotonic clock in microseconds.                        *
+ *******************************************************************************
+ */
+long long nowUs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ *******************************************************************************
+ * addUsage() adds the usage add to sum. The times and the context switches    *
+ * are summed while maxrss and cg_peak keep the largest. addRusage() does the  *
+ * same for the struct rusage of a child that wait4() has reaped.              *
+ *******************************************************************************
+ */
+void addUsage(Usage *sum, const Usage *add)
+{
+	sum->real_us += add->real_us;
+	sum->user_us += add->user_us;
+	sum->sys_us += add->sys_us;
+	sum->maxrss = (add->maxrss > sum->maxrss) ? add->maxrss : sum->maxrss;
+	sum->nvcsw += add->nvcsw;
+	sum->nivcsw += add->nivcsw;
+	sum->cg_peak = (add->cg_peak > sum->cg_peak) ? add->cg_peak : sum->cg_peak;
+}
+
+void addRusage(Usage *sum, const struct rusage *ru)
+{
+	Usage add;
+
+	add.real_us = 0;
+	add.user_us = (long long)ru->ru_utime.tv_sec * 1000000 +
+	              ru->ru_utime.tv_usec;
+	add.sys_us = (long long)ru->ru_stime.tv_sec * 1000000 +
+	             ru->ru_stime.tv_usec;
+	add.maxrss = ru->ru_maxrss;
+	add.nvcsw = ru->ru_nvcsw;
+	add.nivcsw = ru->ru_nivcsw;
+	add.cg_peak = 0;
+	addUsage(sum, &add);
+}
+
+/*
+ *******************************************************************************
+ * printUsage() prints a usage to stderr in the format of the 'time' prefix.   *
+ *******************************************************************************
+ */
+void printUsage(const Usage *u)
+{
+	fflush(stdout);
+	fprintf(stderr, "\nreal\t%lldm%lld.%03llds\n", u->real_us / 60000000,
+	        u->real_us / 1000000 % 60, u->real_us / 1000 % 1000);
+	fprintf(stderr, "user\t%lldm%lld.%03llds\n", u->user_us / 60000000,
+	        u->user_us / 1000000 % 60, u->user_us / 1000 % 1000);
+	fprintf(stderr, "sys\t%lldm%lld.%03llds\n", u->sys_us / 60000000,
+	        u->sys_us / 1000000 % 60, u->sys_us / 1000 % 1000);
+	fprintf(stderr, "maxrss\t%ld kB\n", u->maxrss);
+	fprintf(stderr, "ctxsw\t%ld voluntary, %ld involuntary\n", u->nvcsw,
+	        u->nivcsw);
+	if(u->cg_peak > 0)
+	{
+		fprintf(stderr, "cgpeak\t%ld kB\n", u->cg_peak);
+	}
+}
+
+/*
+ *******************************************************************************
+ * recordLine() adds the usage of a batch line to the --stats summary. Only    *
+ * the totals and the STATS_TOP slowest lines are kept, so a long batch needs  *
+ * no more memory than a short one.                                            *
+ *******************************************************************************
+ */
+void recordLine(unsigned long lineno, const char *line, size_t len,
+                const Usage *u)
+{
+	LineStat *stat;
+	int i;
+
+	stats.lines++;
+	addUsage(&stats.total, u);
+	if(stats.ntop == STATS_TOP &&
+	   u->real_us <= stats.top[STATS_TOP - 1].usage.real_us)
+	{
+		return;
+	}
+
+	i = (stats.ntop < STATS_TOP) ? stats.ntop++ : STATS_TOP - 1;
+	for(; i > 0 && stats.top[i-1].usage.real_us < u->real_us; i--)
+	{
+		stats.top[i] = stats.top[i-1]; //insertion sort, slowest first.
+	}
+	stat = &stats.top[i];
+	stat->lineno = lineno;
+	stat->usage = *u;
+	while(len > 0 && (line[len-1] == '\n' || line[len-1] == '\r'))
+	{
+		len--;
+	}
+	len = (len > STATS_TEXT) ? STATS_TEXT : len;
+	memcpy(stat->text, line, len);
+	stat->text[len] = '\0';
+}
+
+/*
+ *******************************************************************************
+ * printStats() prints the --stats summary to stderr: the totals of the batch  *
+ * and its slowest lines. The times are in seconds and maxrss in kB.           *
+ *******************************************************************************
+ */
+void printStats(void)
+{
+	const Usage *u;
+	int i;
+
+	if(!stats.enabled || stats.lines == 0)
+	{
+		return;
+	}
+
+	fflush(stdout);
+	fprintf(stderr, "\n%8s %9s %9s %9s %9s %8s  %s\n", "line", "real", "user",
+	        "sys", "maxrss", "ctxsw", "command");
+	for(i = 0; i < stats.ntop; i++)
+	{
+		u = &stats.top[i].usage;
+		fprintf(stderr, "%8lu %9.3f %9.3f %9.3f %9ld %8ld  %s\n",
+		        stats.top[i].lineno, u->real_us / 1e6, u->user_us / 1e6,
+		        u->sys_us / 1e6, u->maxrss, u->nvcsw + u->nivcsw,
+		        stats.top[i].text);
+	}
+	u = &stats.total;
+	fprintf(stderr, "%8s %9.3f %9.3f %9.3f %9ld %8ld  %lu lines\n", "total",
+	        u->real_us / 1e6, u->user_us / 1e6, u->sys_us / 1e6, u->maxrss,
+	        u->nvcsw + u->nivcsw, stats.lines);
+}
+
+/*
+ *******************************************************************************
+ * traceOpen() starts a trace in the Chrome trace event format, which          *
+ * chrome://tracing and Perfetto load. Lane 0 of each shell process shows the  *
+ * phases of the shell (readLine, parseLine, checkArgs, parseArgs, the spawns  *
+ * and the waits) and lane N shows stage N of the pipelines, with every child  *
+ * as one event from its spawn to its reaping. The times come from the         *
+ * monotonic clock. Every event is a single write() to a file opened with      *
+ * O_APPEND, so the -j workers can share it. When tracing is off each hook     *
+ * costs one TRACING branch.                                                   *
+ *******************************************************************************
+ */
+void traceOpen(const char *file)
+{
+	char buf[TRACE_EVENT];
+	int len;
+
+	trace_fd = open(file, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC,
+	                0644);
+	if(trace_fd < 0)
+	{
+		perror(file);
+		exit(EXIT_FAILURE);
+	}
+	len = snprintf(buf, sizeof(buf), "[{\"name\":\"process_name\",\"ph\":\"M\","
+	               "\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"myshell\"}}",
+	               (int)getpid());
+	writeAll(trace_fd, buf, len);
+	traceName("thread_name", 0, "shell");
+	trace_last = nowUs();
+	atexit(traceClose);
+}
+
+/*
+ *******************************************************************************
+ * traceClose() ends the JSON array of the trace when the shell exits. The     *
+ * viewers also load a trace that was cut short without it.                    *
+ *******************************************************************************
+ */
+void traceClose(void)
+{
+	writeAll(trace_fd, "\n]\n", 3);
+	close(trace_fd);
+	trace_fd = -1;
+}
+
+/*
+ *******************************************************************************
+ * traceMark() ends a phase: it writes the event name from the end of the last *
+ * phase until now, and now becomes the start of the next phase. child is the  *
+ * pid of the child it started, or 0.                                          *
+ *******************************************************************************
+ */
+void traceMark(const char *name, int lane, pid_t child)
+{
+	long long now = nowUs();
+
+	traceEvent(name, lane, trace_last, now, child);
+	trace_last = now;
+}
+
+/*
+ *******************************************************************************
+ * traceEvent() writes one complete ("X") event of the lane of this process. A *
+ * stage lane is named the first time it is used.                              *
+ *******************************************************************************
+ */
+void traceEvent(const char *name, int lane, long long start_us,
+                long long end_us, pid_t child)
+{
+	char buf[TRACE_EVENT], label[32];
+	int len, i;
+
+	for(; trace_lanes < lane; trace_lanes++)
+	{
+		snprintf(label, sizeof(label), "stage %d", trace_lanes + 1);
+		traceName("thread_name", trace_lanes + 1, label);
+	}
+
+	len = snprintf(buf, sizeof(buf), ",\n{\"name\":\"");
+	for(i = 0; name[i] != '\0' && len < TRACE_EVENT - 160; i++) //JSON string.
+	{
+		if(name[i] == '"' || name[i] == '\\')
+		{
+			buf[len++] = '\\';
+		}
+		buf[len++] = ((unsigned char)name[i] < ' ') ? ' ' : name[i];
+	}
+	len += snprintf(buf + len, sizeof(buf) - len, "\",\"ph\":\"X\",\"ts\":%lld,"
+	                "\"dur\":%lld,\"pid\":%d,\"tid\":%d,\"args\":{\"child\":%d}}",
+	                start_us, end_us - start_us, (int)getpid(), lane,
+	                (int)child);
+	writeAll(trace_fd, buf, len);
+}
+
+/*
+ *******************************************************************************
+ * traceName() writes a metadata event that names this process (kind           *
+ * "process_name") or one of its lanes ("thread_name").                        *
+ *******************************************************************************
+ */
+void traceName(const char *kind, int lane, const char *name)
+{
+	char buf[TRACE_EVENT];
+	int len, i;
+
+	len = snprintf(buf, sizeof(buf), ",\n{\"name\":\"%s\",\"ph\":\"M\",\"pid\":%d,"
+	               "\"tid\":%d,\"args\":{\"name\":\"", kind, (int)getpid(), lane);
+	for(i = 0; name[i] != '\0' && len < TRACE_EVENT - 8; i++)
+	{
+		if(name[i] == '"' || name[i] == '\\')
+		{
+			buf[len++] = '\\';
+		}
+		buf[len++] = ((unsigned char)name[i] < ' ') ? ' ' : name[i];
+	}
+	len += snprintf(buf + len, sizeof(buf) - len, "\"}}");
+	writeAll(trace_fd, buf, len);
+}
+
+/*
+ *******************************************************************************
+ * executeRedirect() points the stdin and stdout of the calling process to the *
+ * pipe ends in_fd and out_fd (-1 for none) and then to the '<' and '>' files  *
+ * (NULL for none), in that order. It is used by forked children before exec   *
+ * and by builtins that run inside the shell. It returns 0, or -1 after        *
+ * printing the error when a file cannot be opened.                            *
+ *******************************************************************************
+ */
+int executeRedirect(int in_fd, int out_fd, char *in_file, char *out_file)
+{
+	int fd;
+
+	if(in_fd != -1)
+	{
+		dup2(in_fd,STDIN_FILENO);
+	}
+	if(out_fd != -1)
+	{
+		dup2(out_fd,STDOUT_FILENO);
+	}
+	if(in_file != NULL) // < redirection
+	{
+		fd = open(in_file,O_RDONLY);
+		if(fd < 0)
+		{
+			perror(in_file);
+			return -1;
+		}
+		dup2(fd,STDIN_FILENO);
+		close(fd);
+	}
+	if(out_file != NULL) // > redirection
+	{
+		fd = creat(out_file,0644);
+		if(fd < 0)
+		{
+			perror(out_file);
+			return -1;
+		}
+		dup2(fd,STDOUT_FILENO);
+		close(fd);
+	}
+
+	return 0;
+}
+
+/*
+ *******************************************************************************
+ * launchCmd() starts launch->argv as a new child and returns its pid, or -1   *
+ * if the child could not be created. The pipe ends in_fd and out_fd become    *
+ * the child's stdin and stdout, then the '<' and '>' targets are applied, and *
+ * the child joins the process group pgid. All other descriptors of the shell  *
+ * are expected to be close-on-exec. The program is found through the command  *
+ * hash table instead of a $PATH walk in execvp(). If a cached path has gone   *
+ * away (ENOENT) the entry is dropped and the launch is retried once with a    *
+ * fresh $PATH search. With -s zygote an idle helper of the pool does the exec *
+ * (see spawnZygote()), and posix_spawn() is used when none is ready.          *
+ *******************************************************************************
+ */
+pid_t launchCmd(Launch *launch)
+{
+	const char *path;
+	pid_t pid = -1;
+	const char *how = "fork";
+	int err, cached, tries = 0;
+	int posix = (spawn_mode != SPAWN_FORK && launch->limits == NULL &&
+	             launch->sched == NULL && launch->cpu < 0);
+
+	fflush(stdout); //do not let the child inherit or lose pending output.
+
+	do
+	{
+		path = hashLookup(launch->argv[0], &cached);
+		if(path == NULL)
+		{
+			err = ENOENT;
+			break;
+		}
+		err = -1;
+		if(posix && spawn_mode == SPAWN_ZYGOTE)
+		{
+			how = "zygote";
+			err = spawnZygote(path, launch, &pid); //-1: no helper to use.
+		}
+		if(err >= 0)
+		{
+			//the helper did it, or its exec() failed.
+		}
+		else if(posix) //limits and sched are set in the child, after a fork().
+		{
+			how = "posix_spawn";
+			err = spawnPosix(path, launch, &pid);
+		}
+		else
+		{
+			err = spawnFork(path, launch, &pid);
+		}
+		if(err == ENOENT && cached)
+		{
+			hashForget(launch->argv[0]);
+		}
+	} while(err == ENOENT && cached && tries++ == 0);
+
+	if(TRACING) //from the end of the last phase: lookup and spawn.
+	{
+		traceMark(how, launch->lane, pid);
+		launch->start_us = trace_last;
+	}
+
+	if(err != 0) //a failed open() or exec() is reported here.
+	{
+		errno = err;
+		perror("Command");
+		launch_errors++;
+		return -1;
+	}
+	return pid;
+}
+
+/*
+ *******************************************************************************
+ * spawnPosix() is the posix_spawn backend of launchCmd(). The redirections    *
+ * are expressed as file actions and glibc starts the child with               *
+ * clone(CLONE_VM|CLONE_VFORK), so the parent's page tables are never copied.  *
+ * It returns 0 or the errno of the failed open() or exec().                   *
+ *******************************************************************************
+ */
+int spawnPosix(const char *path, Launch *launch, pid_t *pid)
+{
+	posix_spawn_file_actions_t actions, *file_actions = NULL;
+	posix_spawnattr_t attr;
+	sigset_t sigdef;
+	short flags = POSIX_SPAWN_SETSIGDEF;
+	int err;
+
+	if(launch->in_fd != -1 || launch->out_fd != -1 ||
+	   launch->in_file != NULL || launch->out_file != NULL)
+	{
+		//glibc allocates the action list, so only build one when needed.
+		file_actions = &actions;
+		posix_spawn_file_actions_init(&actions);
+	}
+	if(launch->in_fd != -1)
+	{
+		posix_spawn_file_actions_adddup2(&actions, launch->in_fd, STDIN_FILENO);
+	}
+	if(launch->out_fd != -1)
+	{
+		posix_spawn_file_actions_adddup2(&actions, launch->out_fd,
+		                                 STDOUT_FILENO);
+	}
+	if(launch->in_file != NULL)
+	{
+		posix_spawn_file_actions_addopen(&actions, STDIN_FILENO,
+		                                 launch->in_file, O_RDONLY, 0);
+	}
+	if(launch->out_file != NULL)
+	{
+		posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO,
+		                                 launch->out_file,
+		                                 O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	}
+
+	posix_spawnattr_init(&attr);
+	defaultSignals(&sigdef);
+	posix_spawnattr_setsigdefault(&attr, &sigdef);
+	if(launch->pgid != -1)
+	{
+		posix_spawnattr_setpgroup(&attr, launch->pgid);
+		flags |= POSIX_SPAWN_SETPGROUP;
+	}
+	posix_spawnattr_setflags(&attr, flags);
+
+	err = posix_spawn(pid, path, file_actions, &attr, launch->argv, environ);
+	if(file_actions != NULL)
+	{
+		posix_spawn_file_actions_destroy(&actions);
+	}
+	posix_spawnattr_destroy(&attr);
+
+	return err;
+}
+
+/*
+ *******************************************************************************
+ * spawnFork() is the classic fork(), dup2(), execv() backend of launchCmd().  *
+ * A close-on-exec pipe reports a failed exec() back to the parent, so both    *
+ * backends return errors the same way: 0 or the errno of the exec().          *
+ *******************************************************************************
+ */
+int spawnFork(const char *path, Launch *launch, pid_t *pid)
+{
+	int err = 0, err_pipe[2];
+
+	if(pipe2(err_pipe, O_CLOEXEC) < 0)
+	{
+		return errno;
+	}
+
+	*pid = fork();
+	if(*pid < 0) //Error
+	{
+		err = errno;
+		perror("fork");
+		printf("Failed to make child.\n");
+	}
+	else if(*pid == 0) //Child
+	{
+		close(err_pipe[0]);
+		if(launch->pgid != -1)
+		{
+			setpgid(0, launch->pgid);
+		}
+		resetSignals();
+		if(launch->limits != NULL)
+		{
+			applyLimits(launch);
+		}
+		if(launch->sched != NULL || launch->cpu >= 0)
+		{
+			applySched(launch);
+		}
+		if(executeRedirect(launch->in_fd, launch->out_fd, launch->in_file,
+		                   launch->out_file) < 0)
+		{
+			_exit(EXIT_FAILURE);
+		}
+		execv(path, launch->argv);
+		err = errno;
+		if(write(err_pipe[1], &err, sizeof(err)) < 0)
+		{
+			perror("write");
+		}
+		_exit(127); //_exit(): the stdio buffers belong to the parent.
+	}
+	else //Parent: EOF on the pipe means that the exec() succeeded.
+	{
+		close(err_pipe[1]);
+		while(read(err_pipe[0], &err, sizeof(err)) < 0 && errno == EINTR);
+		if(err != 0)
+		{
+			while(waitpid(*pid, NULL, 0) < 0 && errno == EINTR);
+		}
+		close(err_pipe[0]);
+		return err;
+	}
+
+	close(err_pipe[0]);
+	close(err_pipe[1]);
+	return err;
+}
+
+/*
+ *******************************************************************************
+ * spawnZygote() is the -s zygote backend. It hands the launch to an idle      *
+ * helper of the pool, a child that zygoteFill() forked while the shell was    *
+ * waiting anyway, so neither the fork() nor the exec() is on the way of the   *
+ * shell. The request is one message on the helper's socket: a ZygoteMsg and   *
+ * its strings, with the stdin, stdout and stderr of the command passed as     *
+ * SCM_RIGHTS. The shell does not wait for the exec(): a helper that cannot    *
+ * exec reports it itself, exits with 127, like a shell does, and tells        *
+ * zygoteCheck() on its socket. The process group is set by both sides, so it  *
+ * exists as soon as this returns. It returns 0, or -1 when no helper is ready *
+ * or the request does not fit in ZYGOTE_MSG, and then the caller uses         *
+ * posix_spawn().                                                              *
+ *******************************************************************************
+ */
+int spawnZygote(const char *path, Launch *launch, pid_t *pid)
+{
+	static char msg[ZYGOTE_MSG];
+	union
+	{
+		char buf[CMSG_SPACE(3 * sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	ZygoteMsg *head = (ZygoteMsg*)msg;
+	char cwd[PATH_MAX], *p = msg + sizeof(ZygoteMsg);
+	const char *strings[4] = {path, cwd, launch->in_file, launch->out_file};
+	const char *s;
+	struct cmsghdr *cmsg;
+	struct msghdr mh;
+	struct iovec iov;
+	int fds[3], i;
+	size_t len;
+	ssize_t n;
+	Zygote z;
+
+	if(zygotes.owner != getpid() || zygotes.nidle == 0 ||
+	   getcwd(cwd, sizeof(cwd)) == NULL)
+	{
+		return -1;
+	}
+	head->pgid = launch->pgid;
+	head->has_in = (launch->in_file != NULL);
+	head->has_out = (launch->out_file != NULL);
+	for(head->argc = 0; launch->argv[head->argc] != NULL; head->argc++);
+	for(i = 0; i < 4 + head->argc; i++)
+	{
+		s = (i < 4) ? strings[i] : launch->argv[i - 4];
+		if(s == NULL)
+		{
+			continue;
+		}
+		len = strlen(s) + 1;
+		if(p + len > msg + sizeof(msg))
+		{
+			return -1; //a huge argv, like the long_line benchmark.
+		}
+		memcpy(p, s, len);
+		p += len;
+	}
+	fds[0] = (launch->in_fd != -1) ? launch->in_fd : STDIN_FILENO;
+	fds[1] = (launch->out_fd != -1) ? launch->out_fd : STDOUT_FILENO;
+	fds[2] = STDERR_FILENO;
+
+	memset(&mh, 0, sizeof(mh));
+	iov.iov_base = msg;
+	iov.iov_len = p - msg;
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+	mh.msg_control = control.buf;
+	mh.msg_controllen = sizeof(control.buf);
+	cmsg = CMSG_FIRSTHDR(&mh);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+	z = zygotes.idle[--zygotes.nidle];
+	while((n = sendmsg(z.sock, &mh, MSG_NOSIGNAL)) < 0 && errno == EINTR);
+	if(n < 0) //the helper is gone.
+	{
+		close(z.sock);
+		while(waitpid(z.pid, NULL, 0) < 0 && errno == EINTR);
+		return -1;
+	}
+	zygotes.spent[zygotes.nspent++] = z.sock; //a close() here wakes it.
+	*pid = z.pid;
+	if(launch->pgid != -1)
+	{
+		setpgid(*pid, launch->pgid); //also here, whoever runs first.
+	}
+
+	return 0;
+}
+
+/*
+ *******************************************************************************
+ * zygoteFill() forks helpers until the pool has ZYGOTE_POOL of them. It runs  *
+ * from superReap() and superIdle(), when the shell is about to wait for its   *
+ * children or for input anyway, so the forks overlap the work of the          *
+ * commands. Only the shell that mainLoop() started keeps a pool: the          *
+ * subshells, the -j workers and the server's runners are short lived and      *
+ * would pay for helpers that they never use.                                  *
+ *******************************************************************************
+ */
+void zygoteFill(void)
+{
+	int sv[2];
+	pid_t pid;
+
+	if(spawn_mode != SPAWN_ZYGOTE || zygotes.owner != getpid())
+	{
+		return;
+	}
+	zygoteCheck();
+	while(zygotes.nidle + zygotes.nspent < ZYGOTE_POOL &&
+	      socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == 0)
+	{
+		fflush(stdout);
+		pid = fork();
+		if(pid == 0)
+		{
+			zygoteMain(sv[1]);
+		}
+		close(sv[1]);
+		if(pid < 0)
+		{
+			close(sv[0]);
+			return;
+		}
+		zygotes.idle[zygotes.nidle].pid = pid;
+		zygotes.idle[zygotes.nidle].sock = sv[0];
+		zygotes.nidle++;
+	}
+}
+
+/*
+ *******************************************************************************
+ * zygoteCheck() closes the sockets of the helpers that were used, once they   *
+ * are done with their request: the exec() closed the helper's end, or the     *
+ * helper sent the errno of an exec() or a redirection that failed, which      *
+ * counts in launch_errors like the failures that the other backends see. A    *
+ * helper still on its way to the exec() keeps its socket until a later call,  *
+ * so the pool is only refilled up to ZYGOTE_POOL helpers in both states.      *
+ *******************************************************************************
+ */
+void zygoteCheck(void)
+{
+	int i = 0, err;
+	ssize_t n;
+
+	if(zygotes.owner != getpid())
+	{
+		return; //copies of the sockets of the shell that forked this one.
+	}
+	while(i < zygotes.nspent)
+	{
+		n = recv(zygotes.spent[i], &err, sizeof(err), MSG_DONTWAIT);
+		if(n < 0 && (errno == EAGAIN || errno == EINTR))
+		{
+			i++;
+			continue;
+		}
+		if(n > 0)
+		{
+			launch_errors++;
+		}
+		close(zygotes.spent[i]);
+		zygotes.spent[i] = zygotes.spent[--zygotes.nspent];
+	}
+}
+
+/*
+ *******************************************************************************
+ * zygoteFlush() ends the idle helpers, which still have the environment of    *
+ * the time they were forked. 'export' and 'unset' call it, and zygoteFill()   *
+ * makes new ones at the next wait. The working directory needs no flush since *
+ * it is part of every request.                                                *
+ *******************************************************************************
+ */
+void zygoteFlush(void)
+{
+	int i;
+
+	if(zygotes.owner != getpid())
+	{
+		return;
+	}
+	for(i = 0; i < zygotes.nidle; i++)
+	{
+		close(zygotes.idle[i].sock);
+		kill(zygotes.idle[i].pid, SIGKILL); //a forked builtin may hold sock.
+		while(waitpid(zygotes.idle[i].pid, NULL, 0) < 0 && errno == EINTR);
+	}
+	zygotes.nidle = 0;
+}
+
+/*
+ *******************************************************************************
+ * zygoteMain() is the life of a helper. It keeps only its socket, as fd 3,    *
+ * and waits for one request of spawnZygote(), as SCHED_BATCH when the shell   *
+ * is SCHED_OTHER, which the command gets back. Any other policy of the shell  *
+ * is left as it is, since an unprivileged helper could not raise it back.     *
+ * Then it does what spawnFork() does in its child: it joins the process       *
+ * group, resets the signals, moves to the shell's directory, takes the passed *
+ * descriptors as 0, 1 and 2, applies the '<' and '>' targets with             *
+ * executeRedirect() and execs. A path that is gone is searched in $PATH once  *
+ * more. When the shell closes the socket it just exits.                       *
+ *******************************************************************************
+ */
+void zygoteMain(int sock)
+{
+	static char msg[ZYGOTE_MSG];
+	union
+	{
+		char buf[CMSG_SPACE(3 * sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	ZygoteMsg *head = (ZygoteMsg*)msg;
+	char *p = msg + sizeof(ZygoteMsg), *path, *cwd;
+	char *in_file = NULL, *out_file = NULL;
+	struct cmsghdr *cmsg;
+	struct msghdr mh;
+	struct iovec iov;
+	struct sched_param param = {0}, inherited;
+	int fds[3], i, err, policy = sched_getscheduler(0);
+	ssize_t n;
+
+	if(sock != 3)
+	{
+		dup3(sock, 3, O_CLOEXEC);
+		sock = 3;
+	}
+	closefrom(4); //the shell's descriptors, its end of the socket too.
+	sched_getparam(0, &inherited);
+	if(policy == SCHED_OTHER) //no preempting on a request.
+	{
+		sched_setscheduler(0, SCHED_BATCH, &param);
+	}
+
+	memset(&mh, 0, sizeof(mh));
+	iov.iov_base = msg;
+	iov.iov_len = sizeof(msg) - 1;
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+	mh.msg_control = control.buf;
+	mh.msg_controllen = sizeof(control.buf);
+	while((n = recvmsg(sock, &mh, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR);
+	cmsg = CMSG_FIRSTHDR(&mh);
+	if(n < (ssize_t)sizeof(ZygoteMsg) || cmsg == NULL ||
+	   cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(fds)))
+	{
+		_exit(EXIT_SUCCESS); //the shell is gone.
+	}
+	memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+	msg[n] = '\0';
+
+	char *argv[head->argc + 1];
+	path = p;
+	p += strlen(p) + 1;
+	cwd = p;
+	p += strlen(p) + 1;
+	if(head->has_in)
+	{
+		in_file = p;
+		p += strlen(p) + 1;
+	}
+	if(head->has_out)
+	{
+		out_file = p;
+		p += strlen(p) + 1;
+	}
+	for(i = 0; i < head->argc; i++)
+	{
+		argv[i] = p;
+		p += strlen(p) + 1;
+	}
+	argv[head->argc] = NULL;
+
+	if(head->pgid != -1)
+	{
+		setpgid(0, head->pgid);
+	}
+	resetSignals();
+	if(policy == SCHED_OTHER) //the command gets the shell's policy back.
+	{
+		sched_setscheduler(0, SCHED_OTHER, &inherited);
+	}
+	for(i = 0; i < 3; i++)
+	{
+		dup2(fds[i], i);
+		close(fds[i]);
+	}
+	if(chdir(cwd) < 0)
+	{
+		perror(cwd);
+	}
+	if(executeRedirect(-1, -1, in_file, out_file) < 0)
+	{
+		err = errno;
+		if(write(sock, &err, sizeof(err)) < 0) //for zygoteCheck().
+		{
+			perror("write");
+		}
+		_exit(EXIT_FAILURE);
+	}
+	execv(path, argv);
+	if(errno == ENOENT)
+	{
+		execvp(argv[0], argv); //the hash table had a stale path.
+	}
+	err = errno;
+	perror("Command");
+	if(write(sock, &err, sizeof(err)) < 0)
+	{
+		perror("write");
+	}
+	_exit(127);
+}
+
+/*
+ *******************************************************************************
+ * applyLimits() runs in a child between the fork() and the exec. The child    *
+ * first joins the cgroup of its pipeline, if it has one, and then lowers its  *
+ * rlimits: RLIMIT_CPU, with SIGKILL one second after the SIGXCPU,             *
+ * RLIMIT_NPROC and, only when there is no memory.max to do it better,         *
+ * RLIMIT_AS for mem.                                                          *
+ *******************************************************************************
+ */
+void applyLimits(const Launch *launch)
+{
+	const Limits *limits = launch->limits;
+	char pid[24];
+
+	if(launch->cg_fd != -1)
+	{
+		snprintf(pid, sizeof(pid), "%d", (int)getpid());
+		if(write(launch->cg_fd, pid, strlen(pid)) < 0)
+		{
+			perror("cgroup.procs");
+		}
+	}
+	if(limits->mem > 0 && launch->cg_fd == -1)
+	{
+		lowerLimit(RLIMIT_AS, limits->mem, limits->mem);
+	}
+	if(limits->cpu > 0)
+	{
+		lowerLimit(RLIMIT_CPU, limits->cpu, limits->cpu + 1);
+	}
+	if(limits->nproc > 0)
+	{
+		lowerLimit(RLIMIT_NPROC, limits->nproc, limits->nproc);
+	}
+}
+
+/*
+ *******************************************************************************
+ * lowerLimit() sets an rlimit, but never above the hard limit that the        *
+ * process already has, which only root could raise.                           *
+ *******************************************************************************
+ */
+void lowerLimit(int resource, rlim_t soft, rlim_t hard)
+{
+	struct rlimit rl;
+
+	if(getrlimit(resource, &rl) == 0 && rl.rlim_max != RLIM_INFINITY)
+	{
+		hard = (hard < rl.rlim_max) ? hard : rl.rlim_max;
+		soft = (soft < hard) ? soft : hard;
+	}
+	rl.rlim_cur = soft;
+	rl.rlim_max = hard;
+	if(setrlimit(resource, &rl) < 0)
+	{
+		perror("setrlimit");
+	}
+}
+
+/*
+ *******************************************************************************
+ * cgroupRoot() finds, once, the cgroup v2 directory that the cgroups of the   *
+ * limited pipelines are made in, or returns NULL when there is none and only  *
+ * rlimits are used. It is MYSHELL_CGROUP when set. Otherwise it is the        *
+ * shell's own cgroup, when that has the memory controller and the shell may   *
+ * write to it (a delegated subtree). The shell then moves itself into a       *
+ * 'shell' leaf below it, since cgroup v2 only hands controllers to the        *
+ * children of a cgroup that has no processes of its own. Either way the       *
+ * memory and cpu controllers must be enabled for its children.                *
+ *******************************************************************************
+ */
+const char* cgroupRoot(void)
+{
+	static char root[PATH_MAX];
+	char mount[PATH_MAX], type[32], leaf[PATH_MAX + 8], pid[24];
+	char *line = NULL, *env = getenv(CGROUP_ENV);
+	size_t size = 0;
+	FILE *file;
+	int found = 0;
+
+	if(cg_state != 0)
+	{
+		return (cg_state > 0) ? root : NULL;
+	}
+	cg_state = -1;
+
+	if(env != NULL && env[0] != '\0')
+	{
+		snprintf(root, sizeof(root), "%s", env);
+	}
+	else
+	{
+		file = fopen("/proc/self/mounts", "r"); //where cgroup2 is mounted.
+		while(file != NULL && !found &&
+		      fscanf(file, "%*s %4095s %31s %*[^\n]", mount, type) == 2)
+		{
+			found = !strcmp(type, "cgroup2");
+		}
+		if(file != NULL)
+		{
+			fclose(file);
+		}
+		file = (found) ? fopen("/proc/self/cgroup", "r") : NULL;
+		found = 0;
+		while(file != NULL && !found && getline(&line, &size, file) > 0)
+		{
+			if(!strncmp(line, "0::", 3)) //the cgroup v2 entry.
+			{
+				line[strcspn(line, "\n")] = '\0';
+				snprintf(root, sizeof(root), "%s%s", mount,
+				         strcmp(line + 3, "/") ? line + 3 : "");
+				found = 1;
+			}
+		}
+		if(file != NULL)
+		{
+			fclose(file);
+		}
+		free(line);
+
+		snprintf(pid, sizeof(pid), "%d", (int)getpid());
+		if(!found ||
+		   cgroupRead(root, "cgroup.controllers", leaf, sizeof(leaf)) < 0 ||
+		   strstr(leaf, "memory") == NULL) //nothing to hand on: stay put.
+		{
+			return NULL;
+		}
+		snprintf(leaf, sizeof(leaf), "%s/shell", root);
+		if((mkdir(leaf, 0755) < 0 && errno != EEXIST) ||
+		   cgroupWrite(leaf, "cgroup.procs", pid) < 0)
+		{
+			return NULL;
+		}
+	}
+
+	cgroupWrite(root, "cgroup.subtree_control", "+memory +cpu");
+	if(cgroupRead(root, "cgroup.subtree_control", type, sizeof(type)) < 0 ||
+	   strstr(type, "memory") == NULL)
+	{
+		if(env != NULL && env[0] != '\0')
+		{
+			fprintf(stderr, "limit: %s: no memory controller, using rlimits\n",
+			        root);
+		}
+		return NULL;
+	}
+	cg_state = 1;
+
+	return root;
+}
+
+/*
+ *******************************************************************************
+ * cgroupOpen() makes the cgroup of a limited pipeline below cgroupRoot() and  *
+ * writes its memory.max and cpu.max. The path goes to dir (PATH_MAX bytes).   *
+ * It returns its cgroup.procs opened for writing, close-on-exec, for          *
+ * applyLimits(), or -1 when there is no cgroup.                               *
+ *******************************************************************************
+ */
+int cgroupOpen(const Limits *limits, char *dir)
+{
+	const char *root = cgroupRoot();
+	char value[64], procs[PATH_MAX + 16];
+	int fd;
+
+	if(root == NULL)
+	{
+		return -1;
+	}
+	snprintf(dir, PATH_MAX, "%s/job-%d-%lu", root, (int)getpid(), cg_jobs++);
+	if(mkdir(dir, 0755) < 0)
+	{
+		return -1;
+	}
+
+	if(limits->mem > 0)
+	{
+		snprintf(value, sizeof(value), "%lld", limits->mem);
+		cgroupWrite(dir, "memory.max", value);
+		cgroupWrite(dir, "memory.swap.max", "0"); //or the limit only swaps.
+	}
+	if(limits->cpus > 0)
+	{
+		snprintf(value, sizeof(value), "%lld %d",
+		         limits->cpus * CPU_PERIOD / 1000, CPU_PERIOD);
+		cgroupWrite(dir, "cpu.max", value);
+	}
+
+	snprintf(procs, sizeof(procs), "%s/cgroup.procs", dir);
+	fd = open(procs, O_WRONLY | O_CLOEXEC);
+	if(fd < 0)
+	{
+		rmdir(dir);
+	}
+
+	return fd;
+}
+
+/*
+ *******************************************************************************
+ * cgroupClose() is called once the pipeline of a cgroup is reaped. The        *
+ * memory.peak of the cgroup goes to the usage of the line, a memory limit     *
+ * that killed something is reported, and the cgroup is removed. rmdir() fails *
+ * when something that the pipeline left behind still runs, and then the       *
+ * cgroup stays.                                                               *
+ *******************************************************************************
+ */
+void cgroupClose(const char *dir, int fd, const char *name)
+{
+	char buf[512], *kills;
+	long peak;
+
+	close(fd);
+	if(cgroupRead(dir, "memory.peak", buf, sizeof(buf)) > 0) //Linux 5.19+.
+	{
+		peak = atoll(buf) / 1024;
+		usage.cg_peak = (peak > usage.cg_peak) ? peak : usage.cg_peak;
+	}
+	if(cgroupRead(dir, "memory.events", buf, sizeof(buf)) > 0 &&
+	   (kills = strstr(buf, "oom_kill ")) != NULL && atol(kills + 9) > 0)
+	{
+		fprintf(stderr, "limit: %s: killed by the memory limit\n", name);
+	}
+	rmdir(dir);
+}
+
+/*
+ *******************************************************************************
+ * cgroupWrite() writes value to the file of a cgroup directory and            *
+ * cgroupRead() reads at most size - 1 bytes of it into buf, NUL ended. They   *
+ * return -1 on an error and cgroupRead() the bytes read.                      *
+ *******************************************************************************
+ */
+int cgroupWrite(const char *dir, const char *file, const char *value)
+{
+	char path[PATH_MAX + 32];
+	int fd, n;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, file);
+	fd = open(path, O_WRONLY | O_CLOEXEC);
+	if(fd < 0)
+	{
+		return -1;
+	}
+	n = write(fd, value, strlen(value));
+	close(fd);
+
+	return (n < 0) ? -1 : 0;
+}
+
+int cgroupRead(const char *dir, const char *file, char *buf, size_t size)
+{
+	char path[PATH_MAX + 32];
+	int fd, n;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, file);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0)
+	{
+		return -1;
+	}
+	n = read(fd, buf, size - 1);
+	close(fd);
+	buf[(n > 0) ? n : 0] = '\0';
+
+	return n;
+}
+
+/*
+ *******************************************************************************
+ * applySched() runs in a child between the fork() and the exec, after         *
+ * applyLimits(). It sets the CPU affinity, to the cpu= of a 'sched' prefix or *
+ * else to the CPU that -p picked, and then the scheduling policy, the nice    *
+ * value and the I/O priority that the prefix gives.                           *
+ *******************************************************************************
+ */
+void applySched(const Launch *launch)
+{
+	const Sched *sched = launch->sched;
+	struct sched_param param = {0};
+	cpu_set_t cpus;
+
+	if(sched != NULL && CPU_COUNT(&sched->cpus) > 0)
+	{
+		cpus = sched->cpus;
+	}
+	else
+	{
+		CPU_ZERO(&cpus);
+		if(launch->cpu >= 0)
+		{
+			CPU_SET(launch->cpu, &cpus);
+		}
+	}
+	if(CPU_COUNT(&cpus) > 0 && sched_setaffinity(0, sizeof(cpus), &cpus) < 0)
+	{
+		perror("sched_setaffinity");
+	}
+	if(sched == NULL)
+	{
+		return;
+	}
+
+	if(sched->policy != -1 && sched_setscheduler(0, sched->policy, &param) < 0)
+	{
+		perror("sched_setscheduler");
+	}
+	if(sched->nice != NO_NICE && setpriority(PRIO_PROCESS, 0, sched->nice) < 0)
+	{
+		perror("setpriority");
+	}
+	if(sched->ioprio != -1 &&
+	   syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, sched->ioprio) < 0)
+	{
+		perror("ioprio_set");
+	}
+}
+
+/*
+ *******************************************************************************
+ * pinInit() orders, once, the CPUs that the shell may run on so that CPUs     *
+ * which share the most are side by side: by package, then by core, so the     *
+ * hyperthreads of a core come one after the other. Adjacent stages of a       *
+ * pinned pipeline get adjacent CPUs of pin_order and so share their caches.   *
+ *******************************************************************************
+ */
+void pinInit(void)
+{
+	char path[96];
+	long long keys[CPU_SETSIZE], key;
+	cpu_set_t cpus;
+	int cpu, i;
+
+	pin_ncpus = 0;
+	if(sched_getaffinity(0, sizeof(cpus), &cpus) < 0)
+	{
+		return;
+	}
+	pin_order = (int*)malloc(CPU_COUNT(&cpus) * sizeof(int));
+	if(pin_order == NULL)
+	{
+		fprintf(stderr,"ERROR: malloc() failure.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for(cpu = 0; cpu < CPU_SETSIZE; cpu++)
+	{
+		if(!CPU_ISSET(cpu, &cpus))
+		{
+			continue;
+		}
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/"
+		         "physical_package_id", cpu);
+		key = readLong(path) << 40;
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/"
+		         "core_id", cpu);
+		key |= (readLong(path) & 0xfffff) << 20 | cpu;
+
+		for(i = pin_ncpus; i > 0 && keys[i-1] > key; i--) //insertion sort.
+		{
+			keys[i] = keys[i-1];
+			pin_order[i] = pin_order[i-1];
+		}
+		keys[i] = key;
+		pin_order[i] = cpu;
+		pin_ncpus++;
+	}
+}
+
+/*
+ *******************************************************************************
+ * pinBase() returns where in pin_order the first stage of a pipeline goes:    *
+ * the CPU that the shell (or the -j worker) runs on now, so that pipelines    *
+ * that run at the same time start apart. It returns -1 when there are not two *
+ * CPUs to pin to.                                                             *
+ *******************************************************************************
+ */
+int pinBase(void)
+{
+	int cpu, i;
+
+	if(pin_ncpus < 0)
+	{
+		pinInit();
+	}
+	if(pin_ncpus < 2)
+	{
+		return -1;
+	}
+
+	cpu = sched_getcpu();
+	for(i = 0; i < pin_ncpus; i++)
+	{
+		if(pin_order[i] == cpu)
+		{
+			return i;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ *******************************************************************************
+ * readLong() returns the number that a small file like a sysfs attribute      *
+ * holds, or 0 when it cannot be read.                                         *
+ *******************************************************************************
+ */
+long readLong(const char *path)
+{
+	char buf[32];
+	ssize_t n;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0)
+	{
+		return 0;
+	}
+	n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	buf[(n > 0) ? n : 0] = '\0';
+
+	return atol(buf);
+}
+
+/*
+ *******************************************************************************
+ * superInit() creates the child supervisor: one epoll set that every wait of  *
+ * the shell sleeps in. A child is watched through its pidfd, which becomes    *
+ * readable when the child exits, so any number of children are waited for at  *
+ * once and in the order they end, with a timeout if needed. The SIGCHLD self- *
+ * pipe is in the set too: it reports the stopped jobs, which a pidfd does     *
+ * not, and it is the fallback on kernels without pidfd_open() (before 5.3).   *
+ * An interactive shell also watches the terminal.                             *
+ *******************************************************************************
+ */
+void superInit(void)
+{
+	struct epoll_event ev;
+
+	super_fd = epoll_create1(EPOLL_CLOEXEC);
+	if(super_fd < 0)
+	{
+		perror("epoll_create1");
+		exit(EXIT_FAILURE);
+	}
+
+	ev.events = EPOLLIN;
+	ev.data.u64 = (uint64_t)(int64_t)EV_SIGCHLD;
+	epoll_ctl(super_fd, EPOLL_CTL_ADD, sigchld_pipe[0], &ev);
+	if(interactive)
+	{
+		setvbuf(stdin, NULL, _IONBF, 0); //no input hidden in a stdio buffer.
+		ev.data.u64 = (uint64_t)(int64_t)EV_INPUT;
+		epoll_ctl(super_fd, EPOLL_CTL_ADD, STDIN_FILENO, &ev);
+	}
+}
+
+/*
+ *******************************************************************************
+ * superWatch() adds a child to the supervisor and returns its pidfd, which    *
+ * the caller hands to superForget() once the child is reaped. It returns -1   *
+ * when pidfds are not available, and then only the SIGCHLD self-pipe wakes    *
+ * the supervisor.                                                             *
+ *******************************************************************************
+ */
+int superWatch(pid_t pid)
+{
+	static int no_pidfd = 0;
+	struct epoll_event ev;
+	int pidfd;
+
+	if(no_pidfd || pid <= 0)
+	{
+		return -1;
+	}
+	pidfd = syscall(SYS_pidfd_open, pid, 0);
+	if(pidfd < 0)
+	{
+		no_pidfd = (errno == ENOSYS);
+		return -1;
+	}
+
+	ev.events = EPOLLIN;
+	ev.data.u64 = (uint64_t)pidfd;
+	epoll_ctl(super_fd, EPOLL_CTL_ADD, pidfd, &ev); //pidfds are close-on-exec.
+
+	return pidfd;
+}
+
+/*
+ *******************************************************************************
+ * superForget() takes a pidfd out of the supervisor and closes it. close()    *
+ * alone is not enough: a child forked meanwhile (a -j worker) may still hold  *
+ * a copy, and epoll keeps watching the pidfd, which stays readable, until     *
+ * every copy is closed.                                                       *
+ *******************************************************************************
+ */
+void superForget(int pidfd)
+{
+	if(pidfd != -1)
+	{
+		epoll_ctl(super_fd, EPOLL_CTL_DEL, pidfd, NULL);
+		close(pidfd);
+	}
+}
+
+/*
+ *******************************************************************************
+ * superWait() sleeps until a watched child ends, SIGCHLD arrives, the         *
+ * terminal has input or timeout_ms passes (-1 for no timeout). It only wakes  *
+ * up: the callers reap with WNOHANG. A drained self-pipe is passed on to      *
+ * reapJobs() and terminal input to input_ready.                               *
+ *******************************************************************************
+ */
+void superWait(int timeout_ms)
+{
+	struct epoll_event events[SUPER_EVENTS];
+	char drain[64];
+	int n, i;
+
+	n = epoll_wait(super_fd, events, SUPER_EVENTS, timeout_ms);
+	for(i = 0; i < n; i++)
+	{
+		if((int64_t)events[i].data.u64 == EV_SIGCHLD)
+		{
+			while(read(sigchld_pipe[0], drain, sizeof(drain)) > 0);
+			sigchld_pending = 1;
+		}
+		else if((int64_t)events[i].data.u64 == EV_INPUT)
+		{
+			input_ready = 1;
+		}
+	}
+}
+
+/*
+ *******************************************************************************
+ * superReap() waits for the children pids[0..n) whose statuses[] are still -1 *
+ * and stores their wait statuses there, reaping each one as soon as it ends.  *
+ * Their rusage is added to the line, and ended[] (when not NULL) gets the     *
+ * time each one was reaped. deadline_us (0 for none) is a nowUs() time after  *
+ * which it gives up. It returns how many of the children are still running. A *
+ * single child without a deadline is simply waited for with a blocking        *
+ * wait4(), which needs no pidfd at all.                                       *
+ *******************************************************************************
+ */
+int superReap(pid_t *pids, int n, int *statuses, long long *ended,
+              long long deadline_us)
+{
+	int pidfds[n], left = 0, i, timeout_ms;
+	struct rusage ru;
+	long long now;
+	pid_t pid;
+
+	for(i = 0; i < n; i++)
+	{
+		pidfds[i] = -1;
+		if(pids[i] > 0 && statuses[i] == -1)
+		{
+			left++;
+		}
+	}
+
+	zygoteFill(); //while the children run, not when the next one is needed.
+	if(left == 1 && n == 1 && deadline_us == 0)
+	{
+		while((pid = wait4(pids[0], &statuses[0], 0, &ru)) < 0 &&
+		      errno == EINTR);
+		if(pid > 0)
+		{
+			addRusage(&usage, &ru);
+		}
+		if(ended != NULL)
+		{
+			ended[0] = nowUs();
+		}
+		zygoteCheck(); //a helper that failed to exec has said so by now.
+		return 0;
+	}
+
+	for(i = 0; i < n; i++)
+	{
+		if(pids[i] > 0 && statuses[i] == -1)
+		{
+			pidfds[i] = superWatch(pids[i]);
+		}
+	}
+	while(left > 0)
+	{
+		for(i = 0; i < n; i++)
+		{
+			if(pids[i] <= 0 || statuses[i] != -1 ||
+			   wait4(pids[i], &statuses[i], WNOHANG, &ru) <= 0)
+			{
+				continue;
+			}
+			addRusage(&usage, &ru);
+			if(ended != NULL)
+			{
+				ended[i] = nowUs();
+			}
+			left--;
+		}
+		if(left == 0)
+		{
+			break;
+		}
+
+		timeout_ms = -1;
+		if(deadline_us != 0)
+		{
+			now = nowUs();
+			if(now >= deadline_us)
+			{
+				break;
+			}
+			timeout_ms = (deadline_us - now + 999) / 1000;
+		}
+		superWait(timeout_ms);
+	}
+
+	for(i = 0; i < n; i++)
+	{
+		superForget(pidfds[i]);
+	}
+	zygoteCheck();
+
+	return left;
+}
+
+/*
+ *******************************************************************************
+ * superIdle() waits until the terminal has input and reaps the background     *
+ * jobs that end in the meantime, so they do not stay zombies until the next   *
+ * command. They are reported at the next prompt.                              *
+ *******************************************************************************
+ */
+void superIdle(void)
+{
+	zygoteFill();
+	while(!input_ready)
+	{
+		superWait(-1);
+		reapJobs();
+	}
+	input_ready = 0;
+}
+
+/*
+ *******************************************************************************
+ * setupSignals() installs the signal dispositions of the shell. SIGPIPE is    *
+ * ignored so that a builtin writing to a closed pipe gets EPIPE instead of    *
+ * killing the shell, and an interactive shell ignores SIGTTOU so that it can  *
+ * take the terminal back from a job brought to the foreground. SIGCHLD only   *
+ * writes a byte to a non-blocking self-pipe; the jobs are reaped later by     *
+ * reapJobs(), outside of the handler.                                         *
+ *******************************************************************************
+ */
+void setupSignals(void)
+{
+	struct sigaction sa;
+
+	signal(SIGPIPE, SIG_IGN);
+	if(interactive)
+	{
+		signal(SIGTTOU, SIG_IGN);
+	}
+
+	if(pipe2(sigchld_pipe, O_CLOEXEC | O_NONBLOCK) < 0)
+	{
+		perror("pipe");
+		exit(EXIT_FAILURE);
+	}
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = sigchldHandler;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_RESTART;
+	sigaction(SIGCHLD, &sa, NULL);
+}
+
+/*
+ *******************************************************************************
+ * defaultSignals() fills set with the signals the shell handles itself, which *
+ * every child gets back with their default action. resetSignals() does that   *
+ * in a forked child.                                                          *
+ *******************************************************************************
+ */
+void defaultSignals(sigset_t *set)
+{
+	sigemptyset(set);
+	sigaddset(set, SIGPIPE);
+	sigaddset(set, SIGCHLD);
+	sigaddset(set, SIGTTOU);
+}
+
+void resetSignals(void)
+{
+	signal(SIGPIPE, SIG_DFL);
+	signal(SIGCHLD, SIG_DFL);
+	signal(SIGTTOU, SIG_DFL);
+}
+
+/*
+ *******************************************************************************
+ * sigchldHandler() wakes the shell up through the self-pipe. A full pipe      *
+ * already holds a pending wake-up, so a failed write is fine.                 *
+ *******************************************************************************
+ */
+void sigchldHandler(int sig)
+{
+	int saved_errno = errno;
+	ssize_t unused;
+
+	(void)sig;
+	sigchld_seen = 1; //before the byte, so reapJobs() cannot miss it.
+	unused = write(sigchld_pipe[1], "", 1);
+	(void)unused;
+	errno = saved_errno;
+}
+
+/*
+ *******************************************************************************
+ * reapJobs() collects the background processes that changed state since the   *
+ * last call. The job table is only walked when SIGCHLD has written to the     *
+ * self-pipe, and the pipe is only read when the handler has set sigchld_seen, *
+ * so a batch line that starts no process pays no system call here. The        *
+ * foreground children are never touched here, they are waited for by pid.     *
+ *******************************************************************************
+ */
+void reapJobs(void)
+{
+	char drain[64];
+	int woken = sigchld_pending, i, j, status;
+	Job *job;
+
+	if(!woken && !sigchld_seen)
+	{
+		return; //nothing to read, not even a system call per line.
+	}
+	sigchld_seen = 0;
+	sigchld_pending = 0;
+	while(read(sigchld_pipe[0], drain, sizeof(drain)) > 0)
+	{
+		woken = 1;
+	}
+	if(!woken)
+	{
+		return;
+	}
+
+	for(i = 0; i < job_table.njobs; i++)
+	{
+		job = job_table.jobs[i];
+		for(j = 0; j < job->npids; j++)
+		{
+			if(job->pids[j] < 0 ||
+			   waitpid(job->pids[j], &status,
+			           WNOHANG | WUNTRACED | WCONTINUED) <= 0)
+			{
+				continue;
+			}
+
+			if(WIFSTOPPED(status))
+			{
+				job->state = JOB_STOPPED;
+			}
+			else if(WIFCONTINUED(status))
+			{
+				job->state = JOB_RUNNING;
+			}
+			else
+			{
+				job->pids[j] = -1;
+				job->live--;
+				if(j == job->npids - 1)
+				{
+					job->exit_status = exitStatus(status);
+				}
+			}
+		}
+		if(job->live == 0)
+		{
+			job->state = JOB_DONE;
+		}
+	}
+}
+
+/*
+ *******************************************************************************
+ * notifyJobs() reports the finished jobs before the next prompt, like '[1]+   *
+ * Done    sleep 5 &'. Only an interactive shell does that and forgets the     *
+ * job; a batch keeps it for a later 'wait' or 'jobs'.                         *
+ *******************************************************************************
+ */
+void notifyJobs(void)
+{
+	Job *job;
+	int i = 0;
+
+	if(!interactive)
+	{
+		return;
+	}
+	while(i < job_table.njobs)
+	{
+		job = job_table.jobs[i];
+		if(job->state != JOB_DONE)
+		{
+			i++;
+			continue;
+		}
+		if(job->exit_status == 0)
+		{
+			printf("[%d]   Done\t\t%s\n", job->id, job->text);
+		}
+		else
+		{
+			printf("[%d]   Exit %d\t\t%s\n", job->id, job->exit_status,
+			       job->text);
+		}
+		removeJob(job);
+	}
+}
+
+/*
+ *******************************************************************************
+ * addJob() adds a started job to the job table, with the smallest id that is  *
+ * not in use. The table takes the pids and the malloc()ed text. When too many *
+ * finished jobs were never waited for, the oldest of them is dropped. An      *
+ * interactive shell prints '[id] pgid'.                                       *
+ *******************************************************************************
+ */
+Job* addJob(pid_t *pids, int npids, char *text)
+{
+	Job *job;
+	int i, id = 1, done = 0;
+
+	for(i = 0; i < job_table.njobs; i++)
+	{
+		done += (job_table.jobs[i]->state == JOB_DONE);
+	}
+	for(i = 0; done > JOBS_KEEP_DONE && i < job_table.njobs; i++)
+	{
+		if(job_table.jobs[i]->state == JOB_DONE)
+		{
+			removeJob(job_table.jobs[i]);
+			break;
+		}
+	}
+
+	for(i = 0; i < job_table.njobs; i++) //the ids are not sorted.
+	{
+		if(job_table.jobs[i]->id == id)
+		{
+			id++;
+			i = -1;
+		}
+	}
+
+	if(job_table.njobs == job_table.capacity)
+	{
+		job_table.capacity = job_table.capacity ? job_table.capacity * 2 : 8;
+		job_table.jobs = realloc(job_table.jobs,
+		                         job_table.capacity * sizeof(Job*));
+		if(job_table.jobs == NULL)
+		{
+			fprintf(stderr,"ERROR: malloc() failure.\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	job = malloc(sizeof(Job));
+	if(job == NULL || (job->pids = malloc(npids * sizeof(pid_t))) == NULL)
+	{
+		fprintf(stderr,"ERROR: malloc() failure.\n");
+		exit(EXIT_FAILURE);
+	}
+	memcpy(job->pids, pids, npids * sizeof(pid_t));
+	job->id = id;
+	job->pgid = pids[0];
+	job->npids = npids;
+	job->live = npids;
+	job->state = JOB_RUNNING;
+	job->exit_status = 0;
+	job->text = text;
+	job_table.jobs[job_table.njobs++] = job;
+
+	if(interactive)
+	{
+		printf("[%d] %d\n", job->id, (int)job->pgid);
+	}
+
+	return job;
+}
+
+/*
+ *******************************************************************************
+ * findJob() returns the job named by spec, which is 'N' or '%N' for the job   *
+ * [N]. A NULL spec means the most recent job. It returns NULL if there is no  *
+ * such job.                                                                   *
+ *******************************************************************************
+ */
+Job* findJob(const char *spec)
+{
+	char *end;
+	long id;
+	int i;
+
+	if(spec == NULL)
+	{
+		return job_table.njobs ? job_table.jobs[job_table.njobs - 1] : NULL;
+	}
+
+	if(spec[0] == '%')
+	{
+		spec++;
+	}
+	id = strtol(spec, &end, 10);
+	if(end == spec || *end != '\0')
+	{
+		return NULL;
+	}
+	for(i = 0; i < job_table.njobs; i++)
+	{
+		if(job_table.jobs[i]->id == id)
+		{
+			return job_table.jobs[i];
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ *******************************************************************************
+ * waitJob() blocks until every process of the job has terminated and returns  *
+ * the exit status of its last process. The resources of the job count for the *
+ * line that waits for it. When wait_deadline passes first, the job is left    *
+ * running in the table and TIMEOUT_STATUS is returned.                        *
+ *******************************************************************************
+ */
+int waitJob(Job *job)
+{
+	int statuses[job->npids], j;
+
+	for(j = 0; j < job->npids; j++)
+	{
+		statuses[j] = -1;
+	}
+	superReap(job->pids, job->npids, statuses, NULL, wait_deadline);
+
+	for(j = 0; j < job->npids; j++)
+	{
+		if(job->pids[j] < 0 || (statuses[j] == -1 && wait_deadline != 0))
+		{
+			continue; //done before, or still running at the deadline.
+		}
+		job->pids[j] = -1;
+		job->live--;
+		if(statuses[j] != -1 && j == job->npids - 1)
+		{
+			job->exit_status = exitStatus(statuses[j]);
+		}
+	}
+	if(job->live > 0)
+	{
+		return TIMEOUT_STATUS;
+	}
+	job->state = JOB_DONE;
+
+	return job->exit_status;
+}
+
+/*
+ *******************************************************************************
+ * removeJob() takes a job out of the job table and frees it.                  *
+ *******************************************************************************
+ */
+void removeJob(Job *job)
+{
+	int i;
+
+	for(i = 0; i < job_table.njobs; i++)
+	{
+		if(job_table.jobs[i] == job)
+		{
+			memmove(&job_table.jobs[i], &job_table.jobs[i + 1],
+			        (job_table.njobs - i - 1) * sizeof(Job*));
+			job_table.njobs--;
+			break;
+		}
+	}
+	free(job->pids);
+	free(job->text);
+	free(job);
+}
+
+/*
+ *******************************************************************************
+ * jobText() rebuilds the command line of the and-or list first..last from the *
+ * AST, for jobs to print. The words lose their quotes and the prefixes are    *
+ * rebuilt from what they set (see prefixText() and schedText()). The text is  *
+ * malloc()ed because the job outlives the per-line arena.                     *
+ *******************************************************************************
+ */
+char* jobText(Ast *ast, int first, int last)
+{
+	Command *cmd;
+	const char *sep;
+	char *text, *p, prefix[PREFIX_TEXT];
+	size_t len = 3;
+	int i, j, k, pass, fan;
+
+	for(pass = 0, text = NULL; pass < 2; pass++) //measure, then copy.
+	{
+		p = text;
+		for(i = first; i <= last; i++)
+		{
+			prefixText(&ast->pipes[i], prefix, sizeof(prefix));
+			len += (pass == 0) ? strlen(prefix) : 0;
+			p = (pass == 0) ? p : stpcpy(p, prefix);
+			for(j = 0; j < ast->pipes[i].ncmds; j++)
+			{
+				cmd = &ast->cmds[ast->pipes[i].cmd + j];
+				if(cmd->sched != NULL)
+				{
+					schedText(cmd->sched, prefix, sizeof(prefix));
+					len += (pass == 0) ? strlen(prefix) : 0;
+					p = (pass == 0) ? p : stpcpy(p, prefix);
+				}
+				for(k = cmd->argv; ast->words[k] != NULL; k++)
+				{
+					if(pass == 0)
+					{
+						len += strlen(ast->words[k]) + 1;
+						continue;
+					}
+					p = stpcpy(p, ast->words[k]);
+					*p++ = ' ';
+				}
+				if(cmd->in != NO_WORD)
+				{
+					if(pass == 0)
+					{
+						len += strlen(ast->words[cmd->in]) + 3;
+					}
+					else
+					{
+						p += sprintf(p, "< %s ", ast->words[cmd->in]);
+					}
+				}
+				if(cmd->out != NO_WORD)
+				{
+					if(pass == 0)
+					{
+						len += strlen(ast->words[cmd->out]) + 3;
+					}
+					else
+					{
+						p += sprintf(p, "> %s ", ast->words[cmd->out]);
+					}
+				}
+				sep = (j == ast->pipes[i].ncmds - 1) ? "" : "| ";
+				if(ast->pipes[i].fanout > 0) //'a |& { b, c } '
+				{
+					fan = ast->pipes[i].ncmds - ast->pipes[i].fanout;
+					sep = (j == fan - 1) ? "|& { " : (j < fan) ? sep :
+					      (j == ast->pipes[i].ncmds - 1) ? "} " : ", ";
+				}
+				if(*sep == ',' && pass == 1)
+				{
+					p[-1] = ','; //'b, c' rather than 'b , c'.
+					sep = " ";
+				}
+				len += (pass == 0) ? strlen(sep) : 0;
+				p = (pass == 0) ? p : stpcpy(p, sep);
+			}
+			if(i < last)
+			{
+				len += (pass == 0) ? 3 : 0;
+				p = (pass == 0) ? p : stpcpy(p, "&& ");
+			}
+		}
+
+		if(pass == 0 && (text = malloc(len)) == NULL)
+		{
+			fprintf(stderr,"ERROR: malloc() failure.\n");
+			exit(EXIT_FAILURE);
+		}
 	}
+	strcpy(p, "&");
 
-	while(args[i] != NULL)
+	return text;
+}
+
+/*
+ *******************************************************************************
+ * prefixText() writes to buf the prefixes of a pipeline the way jobText()     *
+ * shows them, from the fields that parseArgs() filled in: 'time', 'memo',     *
+ * 'timeout SECS', 'pipesize SIZE' and 'limit SPEC --'. The 'limit' shows      *
+ * every limit that applies, those of -l too. It returns buf.                  *
+ *******************************************************************************
+ */
+char* prefixText(const Pipeline *pipeline, char *buf, size_t size)
+{
+	const Limits *limits = pipeline->limits;
+	const char *sep = "";
+	char number[32];
+	size_t len;
+
+	len = snprintf(buf, size, "%s%s", pipeline->timed ? "time " : "",
+	               pipeline->memo ? "memo " : "");
+	if(pipeline->timeout_us > 0)
+	{
+		len += snprintf(buf + len, size - len, "timeout %g ",
+		                pipeline->timeout_us / 1e6);
+	}
+	if(pipeline->pipe_size > 0)
 	{
-		if(!(strcmp(args[i], ";")))
+		len += snprintf(buf + len, size - len, "pipesize %s ",
+		                sizeText(pipeline->pipe_size, number));
+	}
+	if(limits != NULL)
+	{
+		len += snprintf(buf + len, size - len, "limit ");
+		if(limits->mem > 0)
 		{
-			execute_status = 1;
-			break;
+			len += snprintf(buf + len, size - len, "mem=%s",
+			                sizeText(limits->mem, number));
+			sep = ",";
 		}
-		else if(!(strcmp(args[i], "&&")))
+		if(limits->cpu > 0)
 		{
-			execute_status = 2;
-			break;
+			len += snprintf(buf + len, size - len, "%scpu=%lld", sep,
+			                limits->cpu);
+			sep = ",";
+		}
+		if(limits->nproc > 0)
+		{
+			len += snprintf(buf + len, size - len, "%snproc=%lld", sep,
+			                limits->nproc);
+			sep = ",";
+		}
+		if(limits->cpus > 0)
+		{
+			len += snprintf(buf + len, size - len, "%scpus=%g", sep,
+			                limits->cpus / 1000.0);
 		}
-		else if(!(strcmp(args[i], "<")))
+		snprintf(buf + len, size - len, " -- ");
+	}
+
+	return buf;
+}
+
+/*
+ *******************************************************************************
+ * schedText() writes to buf the 'sched SPEC --' prefix of a command, for      *
+ * jobText(), with the CPUs as a list of ranges. A list too long for buf ends  *
+ * in '...'. It returns buf.                                                   *
+ *******************************************************************************
+ */
+char* schedText(const Sched *sched, char *buf, size_t size)
+{
+	static const char *classes[] = {"", "rt", "be", "idle"};
+	int cpu, end, class;
+	size_t len;
+
+	len = snprintf(buf, size, "sched ");
+	if(CPU_COUNT(&sched->cpus) > 0)
+	{
+		len += snprintf(buf + len, size - len, "cpu=");
+		for(cpu = 0; cpu < CPU_SETSIZE; cpu = end + 1)
 		{
-			if(args[i+2] != NULL)
+			if(!CPU_ISSET(cpu, &sched->cpus))
 			{
-				if(!strcmp(args[i+2],">"))
-				{
-					execute_status = 6;
-					break;
-				}
+				end = cpu;
+				continue;
+			}
+			for(end = cpu; end + 1 < CPU_SETSIZE &&
+			    CPU_ISSET(end + 1, &sched->cpus); end++);
+			if(len + 96 > size) //and room for the rest of the spec.
+			{
+				len += snprintf(buf + len, size - len, "...,");
+				break;
+			}
+			len += (end == cpu) ?
+			       snprintf(buf + len, size - len, "%d,", cpu) :
+			       snprintf(buf + len, size - len, "%d-%d,", cpu, end);
+		}
+		buf[len - 1] = ' '; //the last ','.
+	}
+	if(sched->nice != NO_NICE)
+	{
+		len += snprintf(buf + len, size - len, "nice=%d ", sched->nice);
+	}
+	if(sched->policy != -1)
+	{
+		len += snprintf(buf + len, size - len, "policy=%s ",
+		                (sched->policy == SCHED_BATCH) ? "batch" :
+		                (sched->policy == SCHED_IDLE) ? "idle" : "other");
+	}
+	if(sched->ioprio != -1)
+	{
+		class = (sched->ioprio >> IOPRIO_CLASS_SHIFT) & 3;
+		len += (class == 3) ?
+		       snprintf(buf + len, size - len, "io=idle ") :
+		       snprintf(buf + len, size - len, "io=%s:%d ", classes[class],
+		                sched->ioprio & ((1 << IOPRIO_CLASS_SHIFT) - 1));
+	}
+	snprintf(buf + len, size - len, "-- ");
+
+	return buf;
+}
+
+/*
+ *******************************************************************************
+ * sizeText() writes a size in bytes to buf, in the largest of K, M, G and T   *
+ * that divides it, the way parseSize() reads it back. It returns buf.         *
+ *******************************************************************************
+ */
+char* sizeText(long long size, char *buf)
+{
+	static const char units[] = "KMGT";
+	int unit = -1;
+
+	while(unit < 3 && size >= 1024 && size % 1024 == 0)
+	{
+		size /= 1024;
+		unit++;
+	}
+	if(unit < 0)
+	{
+		sprintf(buf, "%lld", size);
+	}
+	else
+	{
+		sprintf(buf, "%lld%c", size, units[unit]);
+	}
+
+	return buf;
+}
+
+/*
+ *******************************************************************************
+ * hashName() is the FNV-1a hash of a command name.                            *
+ *******************************************************************************
+ */
+unsigned int hashName(const char *name)
+{
+	unsigned int h = 2166136261u;
+
+	while(*name != '\0')
+	{
+		h = (h ^ (unsigned char)*name++) * 16777619u;
+	}
+	return h;
+}
+
+/*
+ *******************************************************************************
+ * hashLookup() returns the path that should be executed for name, like bash's *
+ * 'hash'. Names containing a '/' are used as they are. Otherwise the table is *
+ * searched first, and on a miss $PATH is walked once and the result is        *
+ * stored. *cached is set when the path came from the table. The whole table   *
+ * is flushed when $PATH differs from the value it was built with. It returns  *
+ * NULL when the command is not found.                                         *
+ *******************************************************************************
+ */
+const char* hashLookup(const char *name, int *cached)
+{
+	static char buffer[PATH_MAX];
+	const char *path_env = getenv("PATH"), *dir, *end;
+	unsigned int bucket;
+	HashEntry *entry;
+	struct stat st;
+	size_t name_len, dir_len;
+
+	*cached = 0;
+	if(strchr(name, '/') != NULL)
+	{
+		return name;
+	}
+	if(path_env == NULL)
+	{
+		path_env = "/usr/local/bin:/usr/bin:/bin";
+	}
+	if(cmd_hash.path_env == NULL || strcmp(cmd_hash.path_env, path_env))
+	{
+		hashClear();
+		cmd_hash.path_env = strdup(path_env);
+	}
+
+	bucket = hashName(name) % HASH_BUCKETS;
+	for(entry = cmd_hash.buckets[bucket]; entry != NULL; entry = entry->next)
+	{
+		if(!strcmp(entry->name, name))
+		{
+			entry->hits++;
+			cmd_hash.hits++;
+			*cached = 1;
+			return entry->path;
+		}
+	}
+	cmd_hash.misses++;
+
+	name_len = strlen(name);
+	for(dir = path_env; ; dir = end + 1)
+	{
+		end = strchrnul(dir, ':');
+		dir_len = end - dir;
+		if(dir_len + name_len + 2 <= sizeof(buffer))
+		{
+			if(dir_len == 0) //an empty entry means the current directory.
+			{
+				memcpy(buffer, name, name_len + 1);
+			}
+			else
+			{
+				memcpy(buffer, dir, dir_len);
+				buffer[dir_len] = '/';
+				memcpy(buffer + dir_len + 1, name, name_len + 1);
+			}
+			if(stat(buffer, &st) == 0 && S_ISREG(st.st_mode) &&
+			   access(buffer, X_OK) == 0)
+			{
+				break;
 			}
-			execute_status = 3;
-			break;
 		}
-		else if(!(strcmp(args[i], ">")))
+		if(*end == '\0')
 		{
-			execute_status = 4;
-			break;
+			return NULL;
+		}
+	}
+
+	if(buffer[0] != '/') //relative $PATH entries depend on the cwd.
+	{
+		return buffer;
+	}
+	entry = hashAdd(name, buffer);
+
+	return (entry != NULL) ? entry->path : buffer;
+}
+
+/*
+ *******************************************************************************
+ * hashAdd() puts name with its path into the table with one hit and returns   *
+ * the new entry, or NULL when there is no memory for it.                      *
+ *******************************************************************************
+ */
+HashEntry* hashAdd(const char *name, const char *path)
+{
+	unsigned int bucket = hashName(name) % HASH_BUCKETS;
+	size_t name_len = strlen(name);
+	HashEntry *entry;
+
+	entry = (HashEntry*)malloc(sizeof(HashEntry) + name_len + 1 +
+	                           strlen(path) + 1);
+	if(entry == NULL)
+	{
+		return NULL;
+	}
+	memcpy(entry->name, name, name_len + 1);
+	entry->path = entry->name + name_len + 1;
+	strcpy(entry->path, path);
+	entry->hits = 1;
+	entry->next = cmd_hash.buckets[bucket];
+	cmd_hash.buckets[bucket] = entry;
+
+	return entry;
+}
+
+/*
+ *******************************************************************************
+ * hashSend() writes the table to fd for hashRecv(), so the runner of a server *
+ * request can give the session the commands it has looked up. It is $PATH,   *
+ * the hit and miss counts and then the name, path and hits of each entry, all *
+ * NUL ended text, in one write of at most FRAME_MAX bytes, which a pipe takes *
+ * without a reader. The entries that do not fit are left out.                 *
+ *******************************************************************************
+ */
+void hashSend(int fd)
+{
+	char buf[FRAME_MAX];
+	HashEntry *entry;
+	size_t len;
+	int i, n;
+
+	if(cmd_hash.path_env == NULL)
+	{
+		return; //nothing was looked up.
+	}
+	n = snprintf(buf, sizeof(buf), "%s%c%lu%c%lu%c", cmd_hash.path_env, '\0',
+	             cmd_hash.hits, '\0', cmd_hash.misses, '\0');
+	if(n < 0 || (size_t)n >= sizeof(buf))
+	{
+		return;
+	}
+	len = n;
+	for(i = 0; i < HASH_BUCKETS; i++)
+	{
+		for(entry = cmd_hash.buckets[i]; entry != NULL; entry = entry->next)
+		{
+			n = snprintf(buf + len, sizeof(buf) - len, "%s%c%s%c%lu%c",
+			             entry->name, '\0', entry->path, '\0', entry->hits,
+			             '\0');
+			if(n > 0 && (size_t)n < sizeof(buf) - len)
+			{
+				len += n;
+			}
 		}
-		else if(!(strcmp(args[i], "|")))
+	}
+	writeAll(fd, buf, len);
+}
+
+/*
+ *******************************************************************************
+ * hashRecv() reads what hashSend() wrote to fd, until its end, into the table *
+ * of the session: new entries are added and the hits and the counts are taken *
+ * from the runner, which started from a copy of this table. Nothing is taken  *
+ * when the runner's $PATH is not the session's, after an 'export PATH=...'.   *
+ *******************************************************************************
+ */
+void hashRecv(int fd)
+{
+	static char buf[FRAME_MAX];
+	const char *path_env = getenv("PATH"), *name, *path, *p, *end;
+	HashEntry *entry;
+	size_t len = 0;
+	ssize_t n;
+
+	while(len < sizeof(buf) &&
+	      ((n = read(fd, buf + len, sizeof(buf) - len)) > 0 ||
+	       (n < 0 && errno == EINTR)))
+	{
+		len += (n > 0) ? n : 0;
+	}
+	end = buf + len;
+	if(len == 0 || buf[len - 1] != '\0' || path_env == NULL ||
+	   strcmp(buf, path_env))
+	{
+		return;
+	}
+	if(cmd_hash.path_env == NULL || strcmp(cmd_hash.path_env, buf))
+	{
+		hashClear();
+		cmd_hash.path_env = strdup(buf);
+	}
+
+	p = buf + strlen(buf) + 1;
+	if(p < end && p + strlen(p) + 1 < end)
+	{
+		cmd_hash.hits = strtoul(p, NULL, 10);
+		p += strlen(p) + 1;
+		cmd_hash.misses = strtoul(p, NULL, 10);
+		p += strlen(p) + 1;
+	}
+	while(p < end)
+	{
+		name = p;
+		path = name + strlen(name) + 1;
+		if(path >= end || path + strlen(path) + 1 >= end)
 		{
-			execute_status = 5;
 			break;
 		}
-		else
+		p = path + strlen(path) + 1;
+		for(entry = cmd_hash.buckets[hashName(name) % HASH_BUCKETS];
+		    entry != NULL && strcmp(entry->name, name); entry = entry->next);
+		if(entry == NULL)
+		{
+			entry = hashAdd(name, path);
+		}
+		if(entry != NULL)
+		{
+			entry->hits = strtoul(p, NULL, 10);
+		}
+		p += strlen(p) + 1;
+	}
+}
+
+/*
+ *******************************************************************************
+ * hashForget() removes one command from the hash table.                       *
+ *******************************************************************************
+ */
+void hashForget(const char *name)
+{
+	HashEntry **link = &cmd_hash.buckets[hashName(name) % HASH_BUCKETS];
+	HashEntry *entry;
+
+	while((entry = *link) != NULL)
+	{
+		if(!strcmp(entry->name, name))
+		{
+			*link = entry->next;
+			free(entry);
+			return;
+		}
+		link = &entry->next;
+	}
+}
+
+/*
+ *******************************************************************************
+ * hashClear() empties the whole hash table.                                   *
+ *******************************************************************************
+ */
+void hashClear(void)
+{
+	HashEntry *entry, *next;
+	int i;
+
+	for(i = 0; i < HASH_BUCKETS; i++)
+	{
+		for(entry = cmd_hash.buckets[i]; entry != NULL; entry = next)
+		{
+			next = entry->next;
+			free(entry);
+		}
+		cmd_hash.buckets[i] = NULL;
+	}
+	free(cmd_hash.path_env);
+	cmd_hash.path_env = NULL;
+}
+
+/*
+ *******************************************************************************
+ * findBuiltin() looks the command name up in the builtins' table. It returns  *
+ * the table entry or NULL when the command has to be executed as a program.   *
+ *******************************************************************************
+ */
+const Builtin* findBuiltin(const char *name)
+{
+	int i = 0;
+
+	while(builtins[i].name != NULL)
+	{
+		if(!strcmp(builtins[i].name, name))
+		{
+			return &builtins[i];
+		}
+		i++;
+	}
+	return NULL;
+}
+
+/*
+ *******************************************************************************
+ * runBuiltin() runs a builtin inside the shell process. The stdin and stdout  *
+ * of the shell are saved, pointed to the given pipe ends and files exactly as *
+ * launchCmd() does for a child, and restored after the builtin returns. The   *
+ * return value is the exit status of the builtin.                             *
+ *******************************************************************************
+ */
+int runBuiltin(const Builtin *builtin, Launch *launch)
+{
+	int saved_in = -1, saved_out = -1, exit_status = EXIT_FAILURE;
+
+	fflush(stdout);
+	if(launch->in_fd != -1 || launch->in_file != NULL)
+	{
+		saved_in = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 3);
+	}
+	if(launch->out_fd != -1 || launch->out_file != NULL)
+	{
+		saved_out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 3);
+	}
+
+	if(executeRedirect(launch->in_fd, launch->out_fd, launch->in_file,
+	                   launch->out_file) == 0)
+	{
+		exit_status = builtin->fn(launch->argv);
+	}
+
+	fflush(stdout);
+	clearerr(stdout); //a closed pipe must not poison the shell's stdout.
+	if(saved_in != -1)
+	{
+		dup2(saved_in,STDIN_FILENO);
+		close(saved_in);
+	}
+	if(saved_out != -1)
+	{
+		dup2(saved_out,STDOUT_FILENO);
+		close(saved_out);
+	}
+
+	return exit_status;
+}
+
+/*
+ *******************************************************************************
+ * forkBuiltin() runs a builtin in a child of its own. It is used for the      *
+ * pipeline stages that cannot run inside the shell: a second builtin in the   *
+ * same pipeline, a builtin that would change the state of the shell, any      *
+ * builtin of a background job, and a builtin that a timeout, limits or a      *
+ * 'sched' must apply to.                                                      *
+ *******************************************************************************
+ */
+pid_t forkBuiltin(const Builtin *builtin, Launch *launch)
+{
+	Launch child = *launch;
+	pid_t pid;
+
+	fflush(stdout);
+	pid = fork();
+	if(pid < 0)
+	{
+		perror("fork");
+		printf("Failed to make child.\n");
+	}
+	else if(pid == 0)
+	{
+		if(launch->pgid != -1)
+		{
+			setpgid(0, launch->pgid);
+		}
+		resetSignals();
+		if(launch->limits != NULL)
+		{
+			applyLimits(launch);
+		}
+		if(launch->sched != NULL || launch->cpu >= 0)
+		{
+			applySched(launch);
+		}
+		executeRedirect(launch->in_fd, launch->out_fd, NULL, NULL);
+		//Nothing is exec'ed here, so drop the close-on-exec pipe ends that
+		//belong to the other stages, or their readers would never see EOF.
+		closefrom(STDERR_FILENO + 1);
+		child.in_fd = -1;
+		child.out_fd = -1;
+		_exit(runBuiltin(builtin, &child));
+	}
+	if(TRACING)
+	{
+		traceMark("fork", launch->lane, pid);
+		launch->start_us = trace_last;
+	}
+	else if(launch->pgid != -1)
+	{
+		setpgid(pid, launch->pgid ? launch->pgid : pid);
+	}
+
+	return pid;
+}
+
+/*
+ *******************************************************************************
+ * builtinCd() changes the working directory of the shell. Without an argument *
+ * it goes to $HOME and with '-' to $OLDPWD. PWD and OLDPWD are kept updated.  *
+ *******************************************************************************
+ */
+int builtinCd(char **args)
+{
+	char cwd[PATH_MAX], *dir = args[1];
+
+	if(dir == NULL)
+	{
+		dir = getenv("HOME");
+	}
+	else if(!strcmp(dir, "-"))
+	{
+		dir = getenv("OLDPWD");
+		if(dir != NULL)
 		{
-			cmd_args[i] = args[i]; //Store arguments until to find a delimiter
-			//When we find a delimiter, it means that we just parsed a command
-			//and so we have saved it in **cmd_args.
+			printf("%s\n", dir);
 		}
-		i++;
 	}
-	i++;   //bypass the delimiter in order to find the start of the next 
-		   //command.
-
-	while(args[i] != NULL) // args[i] is the value next to the delimiter.
-    //for example if we typed the command 'pwd ; ls -l' then the value is
-	//args[i] = "ls". We store the remainder of the line without the first
-	//command which is in **cmd_args.
+	if(dir == NULL)
 	{
-		temp[cnt2] = args[i];
-		i++;	
-		cnt2++;
+		fprintf(stderr, "cd: no directory to go to.\n");
+		return EXIT_FAILURE;
 	}
-	while(args[cnt3] != NULL) //the remainder values of args[k] from previous
-	//function execution are being cleansed.
-	{	
-		args[cnt3] = NULL;
-		cnt3++;
+
+	if(getcwd(cwd, sizeof(cwd)) == NULL)
+	{
+		cwd[0] = '\0';
 	}
-	while(temp[cnt4] != NULL) //Now we load the cleansed **temp values in the
-	//**args variable once again.
+	if(chdir(dir) < 0)
 	{
-		args[cnt4] = temp[cnt4];
-		cnt4++;
+		fprintf(stderr, "cd: %s: %s\n", dir, strerror(errno));
+		return EXIT_FAILURE;
 	}
-	while(temp[cnt5] != NULL) //Now we clean all the remaining values of temp
-	//in order to free the memory.
+	setenv("OLDPWD", cwd, 1);
+	if(getcwd(cwd, sizeof(cwd)) != NULL)
 	{
-		temp[cnt5] = NULL;
-		cnt5++;
+		setenv("PWD", cwd, 1);
 	}
 
-	free(temp);
-
-	return execute_status;
+	return EXIT_SUCCESS;
 }
+
 /*
  *******************************************************************************
- * shiftLeftArgs() is a function which takes as an input an array of strings   *
- * which in our case is the line of arguments, and what it does is that it     *
- * shifts left so as to remove the first argument each time that it is called. *
+ * builtinPwd() prints the working directory of the shell.                     *
  *******************************************************************************
  */
-void shiftLeftArgs(char **args)
+int builtinPwd(char **args)
 {
-	char **temp = (char**)malloc(MAX_CMD_NUM * sizeof(char*));
-	int i = 0, cnt1 = 0, cnt2 = 0, cnt3 = 0, cnt4 = 0, cnt5 = 0, execute_status = 0;
+	char cwd[PATH_MAX];
 
-	while(temp[i] != NULL)
+	if(getcwd(cwd, sizeof(cwd)) == NULL)
 	{
-		temp[i] = NULL;
-		i++;
+		perror("pwd");
+		return EXIT_FAILURE;
 	}
-	i = 0;
+	printf("%s\n", cwd);
+
+	return EXIT_SUCCESS;
+}
+
+/*
+ *******************************************************************************
+ * builtinEcho() prints its arguments separated by single spaces. As in        *
+ * /bin/echo a first argument '-n' suppresses the trailing newline.            *
+ *******************************************************************************
+ */
+int builtinEcho(char **args)
+{
+	int i = 1, newline = 1;
 
-	while(args[i+1] != NULL)
+	if(args[i] != NULL && !strcmp(args[i], "-n"))
 	{
-		temp[i] = args[i+1];
+		newline = 0;
 		i++;
 	}
-	i = 0;
-
 	while(args[i] != NULL)
 	{
-		args[i] = NULL;
-		i++;
+		fputs(args[i], stdout);
+		if(args[++i] != NULL)
+		{
+			putchar(' ');
+		}
+	}
+	if(newline)
+	{
+		putchar('\n');
+	}
+
+	return fflush(stdout) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*
+ *******************************************************************************
+ * builtinCat() copies its files, or stdin without any, to stdout with         *
+ * copyFd(), so 'cat < a > b' and 'cat a | wc' need no process and no copy     *
+ * through user space. "-" is stdin. With any option it leaves the work to the *
+ * real cat through runProgram(). Like /bin/cat it will not append a file to   *
+ * itself, and a reader that goes away (EPIPE) just ends it.                   *
+ *******************************************************************************
+ */
+int builtinCat(char **args)
+{
+	static char *stdin_only[] = {"cat", "-", NULL};
+	int exit_status = EXIT_SUCCESS, broken = 0, fd, i;
+	struct stat in, out;
+
+	for(i = 1; args[i] != NULL; i++)
+	{
+		if(args[i][0] == '-' && args[i][1] != '\0')
+		{
+			return runProgram(args);
+		}
+	}
+	if(args[1] == NULL)
+	{
+		args = stdin_only;
+	}
+	if(fstat(STDOUT_FILENO, &out) < 0)
+	{
+		perror("cat: stdout");
+		return EXIT_FAILURE;
 	}
-	i = 0;
 
-	while(temp[i] != NULL)
+	for(i = 1; args[i] != NULL && !broken; i++)
 	{
-		args[i] = temp[i];
-		i++;
+		fd = strcmp(args[i], "-") ? open(args[i], O_RDONLY | O_CLOEXEC)
+		                          : STDIN_FILENO;
+		if(fd < 0 || fstat(fd, &in) < 0)
+		{
+			fprintf(stderr, "cat: %s: %s\n", args[i], strerror(errno));
+			exit_status = EXIT_FAILURE;
+		}
+		else if(S_ISREG(in.st_mode) && in.st_dev == out.st_dev &&
+		        in.st_ino == out.st_ino && lseek(fd, 0, SEEK_CUR) < in.st_size)
+		{
+			fprintf(stderr, "cat: %s: input file is output file\n", args[i]);
+			exit_status = EXIT_FAILURE;
+		}
+		else if(copyFd(fd, STDOUT_FILENO) < 0)
+		{
+			exit_status = EXIT_FAILURE;
+			broken = (errno == EPIPE); //nobody reads any more.
+			if(!broken)
+			{
+				fprintf(stderr, "cat: %s: %s\n", args[i], strerror(errno));
+			}
+		}
+		if(fd > STDIN_FILENO)
+		{
+			close(fd);
+		}
 	}
-	i = 0;
+
+	return exit_status;
 }
 
 /*
  *******************************************************************************
- * executeCmd() is a function which takes as an input the array of commands    *
- * which generated from parseLine() function and executes the first command.   *
- * If the command was executed succesfully then the return value is 0. If      *
- * the command didn't execute then the return value is 1.                      *
+ * copyFd() copies everything from in_fd to out_fd and keeps the data out of   *
+ * user space when it can: copy_file_range() between two regular files,        *
+ * splice() when one side is a pipe and sendfile() from a regular file to      *
+ * anything else, like a terminal or a socket. What a method cannot do         *
+ * (EINVAL, EXDEV, an O_APPEND output, an old kernel) falls through to the     *
+ * next one and in the end to read() and write(). Each method moves the file   *
+ * offsets, so one that stops halfway leaves the rest to the next. A regular   *
+ * file that claims to be empty, like those in /proc, is always read. It       *
+ * returns 0, or -1 with errno set.                                            *
  *******************************************************************************
  */
-int executeCmd(char **args)
+int copyFd(int in_fd, int out_fd)
 {
-	pid_t pid, wait_pid;
-	int status,i=0;
+	static char buf[COPY_BUF];
+	struct stat in, out;
+	int in_file;
+	ssize_t n = -1;
 
-	if(!strcmp(*args, "quit"))
+	if(fstat(in_fd, &in) < 0 || fstat(out_fd, &out) < 0)
 	{
-		quitShell();
+		return -1;
 	}
+	in_file = S_ISREG(in.st_mode) && in.st_size > 0;
 
-	pid = fork();
-	if(pid == 0) //Child
+	if(in_file && S_ISREG(out.st_mode))
 	{
-		//fprintf(stdout, "executeCmd Command %s: %s\n", args[0], strerror(errno));
-		if(execvp(args[0], args) == -1)
+		do
+		{
+			n = copy_file_range(in_fd, NULL, out_fd, NULL, COPY_CHUNK, 0);
+		} while(n > 0 || (n < 0 && errno == EINTR));
+		if(n == 0)
 		{
-			//fprintf(stdout, "executeCmd Command %s: %s\n", args[0], strerror(errno));
-			perror("Command"); 
-			//fprintf(stderr, "%s\n", stderror(errno));
-			//errno is the number of error occured and it is taken from the
-			//library errno.h .If we combine this number with stderror(errno)
-			//then the output is the string which describes this errror. Then
-			//this string can be used inside fprintf() to be redirected from
-			//stdout which is the standard output of perror() to stderr.
+			return 0;
 		}
-		exit(EXIT_FAILURE);
 	}
-	else if (pid < 0)
+	if(S_ISFIFO(in.st_mode) || (in_file && S_ISFIFO(out.st_mode)))
 	{
-		fprintf(stderr,"ERROR: fork() failure."); //perror("fork")
+		do
+		{
+			n = splice(in_fd, NULL, out_fd, NULL, COPY_CHUNK,
+			           SPLICE_F_MOVE | SPLICE_F_MORE);
+		} while(n > 0 || (n < 0 && errno == EINTR));
+		if(n == 0 || errno == EPIPE)
+		{
+			return (int)n;
+		}
 	}
-	else //Parent
+	if(in_file)
 	{
 		do
 		{
-			wait_pid = wait(&status); //on success returns
-			//the pid of the child process which terminated. On failure it 
-			//returns -1.
-		} while(!WIFEXITED(status)); //When the macro
-		//WIFEXITED(status) returns TRUE it means that the child terminated
-		//normally. When the macro WIFSIGNALED(status) returns TRUE it means 
-		//that the child process was terminated by a signal.
+			n = sendfile(out_fd, in_fd, NULL, COPY_CHUNK);
+		} while(n > 0 || (n < 0 && errno == EINTR));
+		if(n == 0 || errno == EPIPE)
+		{
+			return (int)n;
+		}
+	}
+
+	while((n = read(in_fd, buf, sizeof(buf))) != 0)
+	{
+		if(n < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if(n < 0 || writeAll(out_fd, buf, n) < 0)
+		{
+			return -1;
+		}
 	}
 
-	return WEXITSTATUS(status); 
+	return 0;
 }
 
 /*
  *******************************************************************************
- * executeAll() is the main execute functions. It handles all the executions   *
+ * runProgram() runs argv as a child that shares the current stdin and stdout  *
+ * and waits for it. It is for a builtin that leaves a case to the real        *
+ * program. It returns the exit status of the child.                           *
  *******************************************************************************
  */
-void executeAll(char **args)
-{	
-	int execute_status = 0, exit_status = 0;
-	char **cmd_args = (char**)malloc(BUFFER_SIZE * sizeof(char*));
+int runProgram(char **argv)
+{
+	Launch launch;
+	int status = -1;
+	pid_t pid;
+
+	memset(&launch, 0, sizeof(launch));
+	launch.argv = argv;
+	launch.in_fd = -1;
+	launch.out_fd = -1;
+	launch.pgid = -1;
+	launch.cg_fd = -1;
+	launch.cpu = -1;
+	launch.lane = 1;
 
-	if(cmd_args == NULL)
+	pid = launchCmd(&launch);
+	if(pid < 0)
 	{
-		fprintf(stderr,"ERROR: malloc() failure.\n");
-		exit(EXIT_FAILURE);
+		return EXIT_FAILURE;
 	}
+	superReap(&pid, 1, &status, NULL, 0);
 
-	executeRecursive(args,cmd_args);
+	return exitStatus(status);
 }
+
 /*
  *******************************************************************************
- * executeRecursive() is a function which takes as an input the cmd_args and   *
- * the args. Both of the are arrays of strings which were executed in the      *
- * previous execution. parseArgs() is responsible for the cmd_args, args and   *
- * execute_status and then executeRecursive() is responsible for the cases of  *
- * execute_status that are to be executed.                                     *
+ * builtinTrue() and builtinFalse() only return their exit status.             *
  *******************************************************************************
  */
-void executeRecursive(char **args, char **cmd_args)
+int builtinTrue(char **args)
 {
-	int execute_status = 0, exit_status = 0, new_exit_status = 0, i = 0, j = 0;
+	return EXIT_SUCCESS;
+}
+
+int builtinFalse(char **args)
+{
+	return EXIT_FAILURE;
+}
 
-	execute_status = parseArgs(args, cmd_args);
+/*
+ *******************************************************************************
+ * builtinTest() implements 'test' and '['. It supports the unary file         *
+ * operators -e -f -d -r -w -x -s, the string operators -z -n = !=, the        *
+ * integer comparisons -eq -ne -lt -le -gt -ge and a leading '!'. The exit     *
+ * status is 0 for true, 1 for false and 2 for a malformed expression.         *
+ *******************************************************************************
+ */
+int builtinTest(char **args)
+{
+	int argc = 0, result;
 
-	switch (execute_status)
+	while(args[argc] != NULL)
 	{
-		case 0:              /* Inline command     */
-			exit_status = executeCmd(cmd_args);
-			break;
-		case 1:              /* Commands with ';'  */
-			exit_status = executeCmd(cmd_args);
-			executeRecursive(args,cmd_args);
-			break;
-		case 2:				 /* Commands with '&&' */
-			exit_status = executeCmd(cmd_args);
-			if(exit_status == 0)
-			{
-				executeRecursive(args,cmd_args);
-			}
-			break;
-		case 3:              /* Redirect from < */
-			if(args[1] != NULL) // 'command' < file.txt
-			{
-				if(!strcmp(args[1],";"))
-			    {
-					exit_status = executeRedirect(args,cmd_args,execute_status);
-					shiftLeftArgs(args);
-					shiftLeftArgs(args);
-					executeRecursive(args,cmd_args);
-				}
-				else if(!strcmp(args[1],"&&"))
-				{
-					exit_status = executeRedirect(args,cmd_args,execute_status);
-					if(exit_status == 0)
-					{
-						shiftLeftArgs(args);
-						shiftLeftArgs(args);
-						executeRecursive(args,cmd_args);					
-					}
-				}
-			}
-			else
-			{
-				exit_status = executeRedirect(args,cmd_args,execute_status);
-				break;
-			}
-			break;
-		case 4:             /* Redirect to > */
-			exit_status = executeRedirect(args,cmd_args,execute_status);
+		argc++;
+	}
+	if(!strcmp(args[0], "["))
+	{
+		if(strcmp(args[argc-1], "]"))
+		{
+			fprintf(stderr, "[: missing ']'\n");
+			return 2;
+		}
+		argc--;
+	}
 
-			if(args[1] == NULL) // 'command' > file.txt
-			{
-				break;
-			}
-			else if(!strcmp(args[1],";"))
-			{
-				shiftLeftArgs(args);
-				shiftLeftArgs(args);
-				executeRecursive(args,cmd_args);
-			}
-			else if(!strcmp(args[1],"&&"))
-			{
-				if(exit_status == 0)
-				{
-					shiftLeftArgs(args);
-					shiftLeftArgs(args);
-					executeRecursive(args,cmd_args);					
-				}
-			}
-			break;
-		case 5:
-			exit_status = executePipe(args,cmd_args);
-			break;
-		case 6: /* Redirect with < and then with > */
-			exit_status = executeRedirect(args,cmd_args,execute_status);
-			if(args[3] == NULL)
-			{
-				i = 0; while(args[i] != NULL) shiftLeftArgs(args); 
-				break; //empty the whole line and move on to the next one
-			}
-			else if(!strcmp(args[3],";"))
-			{
-				for(int i = 0; i < 4; i++) shiftLeftArgs(args);
-		    	executeRecursive(args,cmd_args);
-			}
-			else if(!strcmp(args[3],"&&"))
+	result = testExpr(argc - 1, args + 1);
+	if(result < 0)
+	{
+		fprintf(stderr, "%s: bad expression\n", args[0]);
+		return 2;
+	}
+
+	return result ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*
+ *******************************************************************************
+ * testExpr() evaluates the argc words of a test expression. It returns 1 for  *
+ * true, 0 for false and -1 when the expression cannot be parsed.              *
+ *******************************************************************************
+ */
+int testExpr(int argc, char **args)
+{
+	struct stat st;
+	char *end;
+	long a, b;
+	int result;
+
+	if(argc > 0 && !strcmp(args[0], "!"))
+	{
+		result = testExpr(argc - 1, args + 1);
+		return result < 0 ? result : !result;
+	}
+
+	switch (argc)
+	{
+		case 0:
+			return 0;
+		case 1:
+			return args[0][0] != '\0';
+		case 2:
+			if(!strcmp(args[0], "-z")) return args[1][0] == '\0';
+			if(!strcmp(args[0], "-n")) return args[1][0] != '\0';
+			if(!strcmp(args[0], "-r")) return access(args[1], R_OK) == 0;
+			if(!strcmp(args[0], "-w")) return access(args[1], W_OK) == 0;
+			if(!strcmp(args[0], "-x")) return access(args[1], X_OK) == 0;
+			if(stat(args[1], &st) < 0)
 			{
-				if(exit_status == 0)
+				st.st_mode = 0;
+				st.st_size = 0;
+				if(strcmp(args[0], "-e") && strcmp(args[0], "-f") &&
+				   strcmp(args[0], "-d") && strcmp(args[0], "-s"))
 				{
-					for(int i = 0; i < 4; i++) shiftLeftArgs(args);
-					executeRecursive(args,cmd_args);					
+					return -1;
 				}
+				return 0;
 			}
-			break;			
+			if(!strcmp(args[0], "-e")) return 1;
+			if(!strcmp(args[0], "-f")) return S_ISREG(st.st_mode);
+			if(!strcmp(args[0], "-d")) return S_ISDIR(st.st_mode);
+			if(!strcmp(args[0], "-s")) return st.st_size > 0;
+			return -1;
+		case 3:
+			if(!strcmp(args[1], "="))  return !strcmp(args[0], args[2]);
+			if(!strcmp(args[1], "!=")) return strcmp(args[0], args[2]) != 0;
+			a = strtol(args[0], &end, 10);
+			if(*args[0] == '\0' || *end != '\0') return -1;
+			b = strtol(args[2], &end, 10);
+			if(*args[2] == '\0' || *end != '\0') return -1;
+			if(!strcmp(args[1], "-eq")) return a == b;
+			if(!strcmp(args[1], "-ne")) return a != b;
+			if(!strcmp(args[1], "-lt")) return a < b;
+			if(!strcmp(args[1], "-le")) return a <= b;
+			if(!strcmp(args[1], "-gt")) return a > b;
+			if(!strcmp(args[1], "-ge")) return a >= b;
+			return -1;
 		default:
-			printf("ERROR: Unexpected execute status %d.\n",execute_status);
-			exit(EXIT_FAILURE);
+			return -1;
 	}
 }
+
 /*
  *******************************************************************************
- * executeRedirect() is a function which takes the cmd_args and the args and   *
- * what it does is that it with respect to the type of redirection that was    *
- * observed, executes the command and redirects either the input or the output *
- * or even both to where the user commanded.                                   *
+ * builtinQuit() terminates the shell.                                         *
  *******************************************************************************
  */
-int executeRedirect(char **args, char **cmd_args, int redirect_mode)
+int builtinQuit(char **args)
 {
-	pid_t pid, wait_pid;
-	int status, fd[2], i = 0;
+	quitShell();
+	return EXIT_SUCCESS;
+}
 
-	pid = fork();
+/*
+ *******************************************************************************
+ * builtinHash() works like bash's 'hash'. Without arguments it prints the     *
+ * remembered commands with their hits and the table's hit and miss counts.    *
+ * 'hash -r' forgets everything and 'hash name...' looks the names up now.     *
+ *******************************************************************************
+ */
+int builtinHash(char **args)
+{
+	HashEntry *entry;
+	int i, cached, exit_status = EXIT_SUCCESS;
 
-	if(pid < 0) //Error
+	if(args[1] != NULL && !strcmp(args[1], "-r"))
 	{
-		perror("fork");
-		printf("Failed to make child.\n");
+		hashClear();
+		cmd_hash.hits = 0;
+		cmd_hash.misses = 0;
+		return EXIT_SUCCESS;
 	}
-	else if(pid == 0) //Child
+	if(args[1] != NULL)
 	{
-		if(redirect_mode == 3) // < redirection
-		{	
-			fd[0] = open(args[0],O_RDONLY);
-			dup2(fd[0],STDIN_FILENO);
-			close(fd[0]);
-		}
-		else if(redirect_mode == 4) // > redirection
-		{
-			fd[1] = creat(args[0],0644);
-			dup2(fd[1],STDOUT_FILENO);
-			close(fd[1]);
-		}
-		else if(redirect_mode == 6) // <> redirection
+		for(i = 1; args[i] != NULL; i++)
 		{
-			fd[0] = open(args[0],O_RDONLY);
-			dup2(fd[0],STDIN_FILENO);
-			close(fd[0]);
-			fd[1] = creat(args[2],0644);
-			dup2(fd[1],STDOUT_FILENO);
-			close(fd[1]);
-		}
-		else 
-		{
-			printf("Not supported redirect mode.\n");
-			exit(EXIT_FAILURE);
-		}
-		//fprintf(stdout, "executeRec Command %s: %s\n", cmd_args[0], strerror(errno));
-		if(execvp(cmd_args[0], cmd_args) == -1)
-		{
-			//fprintf(stdout, "executeRec Command %s: %s\n", cmd_args[0], strerror(errno));
-			perror("Command");
+			if(findBuiltin(args[i]) == NULL && hashLookup(args[i], &cached) == NULL)
+			{
+				fprintf(stderr, "hash: %s: not found\n", args[i]);
+				exit_status = EXIT_FAILURE;
+			}
 		}
-		exit(EXIT_FAILURE);
+		return exit_status;
 	}
-	else //Parent
+
+	printf("hits\tcommand\n");
+	for(i = 0; i < HASH_BUCKETS; i++)
 	{
-		do
+		for(entry = cmd_hash.buckets[i]; entry != NULL; entry = entry->next)
 		{
-			wait_pid = wait(&status); //on success returns
-			//the pid of the child process which terminated. On failure it 
-			//returns -1.
-		} while(!WIFEXITED(status)); //When the macro
-		//WIFEXITED(status) returns TRUE it means that the child terminated
-		//normally. When the macro WIFSIGNALED(status) returns TRUE it means 
-		//that the child process was terminated by a signal.
+			printf("%4lu\t%s\n", entry->hits, entry->path);
+		}
 	}
+	printf("hash: %lu hits, %lu misses\n", cmd_hash.hits, cmd_hash.misses);
 
-	return WEXITSTATUS(status);
+	return EXIT_SUCCESS;
 }
+
 /*
  *******************************************************************************
- * executePipe() is a function which is responsible for pipeline commands. As  *
- * before, the cmd_args are the command before the pipelining that are about   *
- * be executed and args are the rest after the pipeline character.             *
+ * builtinExport() sets environment variables given as NAME=VALUE. Setting     *
+ * PATH this way makes the next lookup flush the command hash table.           *
  *******************************************************************************
  */
-int executePipe(char **args, char **cmd_args)
+int builtinExport(char **args)
 {
-	pid_t pid1, pid2, wait_pid;
-	int status, fd[2], i =0;
+	char *eq;
+	int i, exit_status = EXIT_SUCCESS;
 
-	if(pipe(fd) < 0) /* fd[0]: reading end, fd[1]: writing end */
+	for(i = 1; args[i] != NULL; i++)
 	{
-		perror("pipe");
-		printf("Pipe failed to create.\n");
-		return EXIT_FAILURE;
+		eq = strchr(args[i], '=');
+		if(eq == NULL) //already part of the environment, if it exists.
+		{
+			continue;
+		}
+		*eq = '\0';
+		zygoteFlush(); //the helpers have the old environment.
+		if(eq == args[i] || setenv(args[i], eq + 1, 1) < 0)
+		{
+			fprintf(stderr, "export: bad variable '%s'\n", args[i]);
+			exit_status = EXIT_FAILURE;
+		}
+		*eq = '=';
 	}
 
-	pid1 = fork();
+	return exit_status;
+}
+
+/*
+ *******************************************************************************
+ * builtinUnset() removes environment variables.                               *
+ *******************************************************************************
+ */
+int builtinUnset(char **args)
+{
+	int i;
 
-	if(pid1 < 0) //Error
+	for(i = 1; args[i] != NULL; i++)
 	{
-		perror("fork");
-		printf("Failed to make child.\n");		
+		unsetenv(args[i]);
 	}
-	else if(pid1 == 0) //Child
+	if(i > 1)
 	{
-		close(fd[0]); //close reading end.
-		dup2(fd[1],STDOUT_FILENO);
-
-		if(execvp(cmd_args[0], cmd_args) == -1)
-		{
-			//fprintf(stdout, "executeRec Command %s: %s\n", cmd_args[0], strerror(errno));
-			perror("CommandPipe");
-		}
-		exit(EXIT_FAILURE);
+		zygoteFlush(); //the helpers have the old environment.
 	}
-	else //Parent
-	{
-		close(fd[1]); //close writing end
-		do
-		{
-			wait_pid = wait(&status);
-		} while(!WIFEXITED(status)); 
+	return EXIT_SUCCESS;
+}
 
-		pid2 = fork();
+/*
+ *******************************************************************************
+ * builtinJobs() lists the background jobs with their state. The finished ones *
+ * are shown once and then forgotten.                                          *
+ *******************************************************************************
+ */
+int builtinJobs(char **args)
+{
+	static const char *states[] = {"Running", "Stopped", "Done"};
+	Job *job;
+	int i = 0;
 
-		if(pid2 < 0) //Error
+	reapJobs();
+	while(i < job_table.njobs)
+	{
+		job = job_table.jobs[i];
+		if(job->state == JOB_DONE && job->exit_status != 0)
 		{
-			perror("fork");
-			printf("Failed to make child.\n");			
+			printf("[%d]%c  Exit %-4d\t%s\n", job->id,
+			       (i == job_table.njobs - 1) ? '+' : ' ', job->exit_status,
+			       job->text);
 		}
-		else if(pid2 == 0) //Child
+		else
 		{
-			close(fd[1]); //close writing end.
-			dup2(fd[0],STDIN_FILENO);
+			printf("[%d]%c  %-9s\t%s\n", job->id,
+			       (i == job_table.njobs - 1) ? '+' : ' ', states[job->state],
+			       job->text);
+		}
 
-			executeRecursive(args,cmd_args);
-			exit(EXIT_SUCCESS);
-			printf("Edw erxomai?\n");
+		if(job->state == JOB_DONE)
+		{
+			removeJob(job);
 		}
 		else
 		{
-			close(fd[0]); //close reading end.
-			do
+			i++;
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
+
+/*
+ *******************************************************************************
+ * builtinWait() waits for the given jobs, or for all of them without          *
+ * arguments, and returns the exit status of the last one. A job that is not   *
+ * known gives 127, and a deadline that passes first TIMEOUT_STATUS.           *
+ *******************************************************************************
+ */
+int builtinWait(char **args)
+{
+	int exit_status = EXIT_SUCCESS, i;
+	Job *job;
+
+	if(args[1] == NULL)
+	{
+		while(job_table.njobs > 0)
+		{
+			exit_status = waitJob(job_table.jobs[0]);
+			if(job_table.jobs[0]->state != JOB_DONE)
 			{
-				wait_pid = wait(&status);
-			} while(!WIFEXITED(status)); 
+				fprintf(stderr, "timeout: wait: timed out\n");
+				return exit_status;
+			}
+			removeJob(job_table.jobs[0]);
+		}
+		return exit_status;
+	}
 
-			return WEXITSTATUS(status);
+	for(i = 1; args[i] != NULL; i++)
+	{
+		job = findJob(args[i]);
+		if(job == NULL)
+		{
+			fprintf(stderr, "wait: %s: no such job\n", args[i]);
+			exit_status = 127;
+			continue;
 		}
+		exit_status = waitJob(job);
+		if(job->state != JOB_DONE)
+		{
+			fprintf(stderr, "timeout: wait: timed out\n");
+			return exit_status;
+		}
+		removeJob(job);
+	}
+
+	return exit_status;
+}
+
+/*
+ *******************************************************************************
+ * builtinFg() brings a job, the most recent one without an argument, to the   *
+ * foreground and waits for it. On a terminal the job's process group gets the *
+ * terminal for that time, and a stopped job is continued. A job still running *
+ * at the deadline stays in the background.                                    *
+ *******************************************************************************
+ */
+int builtinFg(char **args)
+{
+	int exit_status, tty = interactive && isatty(STDIN_FILENO);
+	Job *job = findJob(args[1]);
+
+	if(job == NULL)
+	{
+		fprintf(stderr, "fg: %s: no such job\n", args[1] ? args[1] : "current");
+		return EXIT_FAILURE;
+	}
+
+	printf("%s\n", job->text);
+	fflush(stdout);
+	if(tty)
+	{
+		tcsetpgrp(STDIN_FILENO, job->pgid);
+	}
+	if(job->state == JOB_STOPPED)
+	{
+		kill(-job->pgid, SIGCONT);
+	}
+
+	exit_status = waitJob(job);
+	if(tty)
+	{
+		tcsetpgrp(STDIN_FILENO, getpgrp());
+	}
+	if(job->state != JOB_DONE)
+	{
+		fprintf(stderr, "timeout: fg: timed out\n");
+		return exit_status; //it goes on in the background.
 	}
+	removeJob(job);
+
+	return exit_status;
+}
+
+/*
+ *******************************************************************************
+ * builtinBarrier() does nothing in a serial run. In parallel batch mode (-j   *
+ * N) the line it is on waits until every earlier line has finished.           *
+ *******************************************************************************
+ */
+int builtinBarrier(char **args)
+{
+	return EXIT_SUCCESS;
 }